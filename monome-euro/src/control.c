@@ -18,8 +18,16 @@
 
 
 #define SPEEDCYCLE 4
+#define SPEEDIDLECYCLE 100
+#define SPEEDIDLECOUNT 250
 #define SPEEDBUTTONCYCLE 10
 #define CLOCKOUTWIDTH 10
+#define EXTCLOCKTIMEOUT 2000
+#define TRACEDUMPCYCLE 100
+#define ARCREFRESHCYCLE 20
+#define DISPLAYCYCLE 50
+#define SAVEIDLECYCLE 50
+#define SAVEATTEMPTS 3
 
 #define MAXVOLUMELEVEL 7
 
@@ -27,11 +35,33 @@
 #define SPEEDBUTTONTIMER 1
 #define CLOCKTIMER 2
 #define CLOCKOUTTIMER 3
+#define TRACETIMER 4
+#define ARCTIMER 5
+#define DISPLAYTIMER 6
+#define QUEUETIMER 7
+#define SAVETIMER 8
+#define BANKTIMER 9
 
 // following timers are for each voice
 #define NOTEDELAYTIMER 80
 #define GATETIMER  90
 
+#define SAVE_IDLE   0
+#define SAVE_PRESET 1
+#define SAVE_SHARED 2
+#define SAVE_VERIFY 3
+#define SAVE_REVERT 4
+
+#define BANK_IDLE   0
+#define BANK_HEADER 1
+#define BANK_RECORD 2
+#define BANK_CRC    3
+#define BANK_ERROR  4
+
+#define BANKLINELEN 32
+#define SHAREDFIELDCOUNT (sizeof(shared_fields) / sizeof(bank_field_t))
+#define PRESETFIELDCOUNT (sizeof(preset_fields) / sizeof(bank_field_t))
+
 #define PAGE_PARAM  0
 #define PAGE_TRANS  1
 #define PAGE_MATRIX 2
@@ -55,6 +85,42 @@
 #define VOL_DIR_FLIP 2
 #define VOL_DIR_SLEW 3
 
+#define VOICE_ALLOC_DROP     0
+#define VOICE_ALLOC_REDIRECT 1
+#define VOICE_ALLOC_STEAL    2
+
+#define PITCHCOUNT 64
+
+// MIDI clock is 24 ticks per quarter note, so this steps on 16th notes
+#define MIDICLOCKDIVIDER 6
+
+// CCs starting from this one are added to the matrix outputs starting from
+// length: length, algoX, algoY, shift, space, gate length
+#define MIDICCFIRST 20
+#define MIDICCOUT 1
+#define MIDICCCOUNT 6
+
+#define KNOBDEADBAND 192
+#define KNOBMAX 65535
+
+#define GRIDCOLS 16
+#define GRIDROWS 8
+
+#define ARCENCODERS 4
+#define ARCLEDS 64
+#define ARCSPEEDSTEP 5
+
+#define DISPLAYLINES 8
+#define DISPLAYLINELEN 16
+
+#define QUEUELEN 16
+#define QUEUEDATALEN 4
+
+// one random stream per voice plus one for everything else
+#define RANDSTREAMS (NOTECOUNT + 1)
+#define RANDCONTROL NOTECOUNT
+#define PRESETSEED 0x6F726361
+
 
 // presets and data stored in presets
 
@@ -63,45 +129,181 @@ preset_meta_t meta;
 preset_data_t p;
 u8 selected_preset;
 
+// presets are saved from a snapshot, one flash operation after each step
+preset_data_t save_p, verify_p;
+shared_data_t save_s, verify_s;
+shared_data_v0_t shared_v0;
+preset_data_v0_t preset_v0;
+u8 save_index, save_phase, save_attempts, is_bank_saving;
+
+// preset banks are exported and imported one record at a time
+const bank_field_t shared_fields[] = SHARED_BANK_FIELDS;
+const bank_field_t preset_fields[] = PRESET_BANK_FIELDS;
+preset_data_t bank_p;
+shared_data_t bank_s;
+u8 bank_header[BANK_HEADER_LEN];
+u8 bank_state, bank_record, bank_field, bank_byte, bank_pos;
+u16 bank_element;
+u32 bank_value, bank_crc;
+u8 bank_line[BANKLINELEN], bank_line_len;
+u8 is_bank_exporting, export_record, is_bank_imported;
+
 // local vars
 
 u32 gate_length_mod, speed_button;
+u32 clock_next_ms, clock_fraction;
+u16 clock_next_us;
+u16 knob_value, knob_idle;
+u32 ext_clock_last, ext_clock_period, ext_clock_intervals[3];
+u8 ext_clock_index;
 s32 matrix_values[MATRIXOUTS];
-u8 trans_step, trans_sel, reset_phase;
+u8 trans_step, trans_sel, trans_offset, reset_phase;
 u8 is_presets, is_preset_saved;
 s8 prev_octave;
 
-u16 notes_pitch[NOTECOUNT];
-u16 notes_vol[NOTECOUNT];
-u8 notes_on[NOTECOUNT];
+// what timer callbacks need to know about each voice. each voice has 2
+// slots, step() fills the one not in use and then switches, so a timer
+// firing in the middle of a step sees either the previous or the new values
+typedef struct {
+    u16 pitch;
+    u16 vol;
+    u8 on;
+    u8 note;
+} voice_out_t;
+
+voice_out_t voice_out[NOTECOUNT][2];
+volatile u32 voice_out_sel;
+u8 current_notes[NOTECOUNT], current_gates[NOTECOUNT];
+u32 voices_pending, voices_sounding;
+
+// voices are bits of a u32, and each one needs a note delay timer below the
+// gate timers
+typedef char voice_count_check[NOTECOUNT <= 32 && NOTEDELAYTIMER + NOTECOUNT <= GATETIMER ? 1 : -1];
+u16 notes_delay_error[NOTECOUNT];
 u8 time_shift_counter;
 
+u8 grid_fb[GRIDROWS][GRIDCOLS / 2];
+u8 grid_shown[GRIDROWS][GRIDCOLS / 2];
+u8 is_grid_shown;
+
+u8 arc_shown[ARCENCODERS];
+u8 is_arc_shown, is_arc_pending;
+
+char display_lines[DISPLAYLINES][DISPLAYLINELEN];
+u8 display_colours[DISPLAYLINES];
+u8 display_dirty, is_display_pending;
+
+u8 queue_events[QUEUELEN];
+u8 queue_lengths[QUEUELEN];
+u8 queue_data[QUEUELEN][QUEUEDATALEN];
+u8 queue_head, queue_tail;
+s16 queue_deltas[QUEUELEN];
+u8 is_queue_pending, queue_depth_max, queue_depth_shown;
+u16 queue_merged;
+
+u32 rand_state[RANDSTREAMS];
+
+#ifdef I2C_FOLLOWER_READ
+u8 i2c_state[2][I2C_STATE_LEN];
+volatile u8 i2c_state_index;
+#endif
+
+u8 midi_cc[MIDICCCOUNT];
+u8 midi_cc_on;
+
+#ifdef MIDI_SYNC
+u8 midi_ticks, is_midi_running, is_midi_ticking;
+u32 midi_tick_last, midi_step_last, midi_clock_period;
+#endif
+
+#ifdef EVENT_TRACE
+trace_header_t trace_header;
+trace_entry_t trace[TRACELEN];
+u16 trace_head, trace_tail, trace_dropped;
+u32 trace_time, replay_time;
+u8 is_replaying;
+trace_header_t *replay_header;
+trace_entry_t *replay_entries;
+u16 replay_count, replay_knob_next;
+#endif
+
 // prototypes
 
 static void toggle_preset_page(void);
 static void save_preset(void);
+static void init_preset(preset_data_t *preset, u8 index);
+static u8 is_preset_stored(u8 preset);
+static void read_preset(u8 index, preset_data_t *preset);
 static void save_preset_and_confirm(void);
+static void migrate_flash(void);
+static void read_flash_v0(u32 offset, u8 *data, u16 length);
+static void upgrade_preset(preset_data_v0_t *old, preset_data_t *preset, u8 index);
+static void start_save(u8 index, preset_data_t *preset);
+static void continue_save(void);
+static void finish_save(void);
+
+static void export_bank(void);
+static void continue_export(void);
+static void put_bank_record(const bank_field_t *fields, u8 count, u8 *base);
+static void put_bank_byte(u8 byte);
+static void put_bank_crc(void);
+static void flush_bank_line(void);
+static void import_bank(void);
+static void import_bank_byte(u8 byte);
+static void start_bank_record(void);
+static void commit_bank_record(void);
+static void apply_bank_shared(void);
+static u16 bank_record_len(const bank_field_t *fields, u8 count);
+static u32 crc32(u32 crc, u8 byte);
 static void load_preset(u8 preset);
 
 static void toggle_run_stop(void);
 
 static void set_up_i2c(void);
 static void toggle_i2c_device(u8 device);
+static void toggle_i2c_follower(void);
+static void process_i2c(u8 *data, u8 length);
+#ifdef I2C_FOLLOWER_READ
+static void update_i2c_state(void);
+#endif
 
 static void set_vol_dir(u8 dir);
 static void toggle_voice_on(u8 voice);
 static void set_voice_vol(u8 voice, u8 vol);
 static void set_vol_index(u8 index);
+static void set_voice_alloc(u8 alloc);
 
 static void update_speed_from_knob(void);
 static void update_speed_from_buttons(void);
 static void update_speed(u32 speed);
+static u32 step_period_us(void);
+static u32 clock_period_us(void);
+static void external_clock(void);
+static void internal_clock(void);
+static void retime_clock(u32 prev_period);
+static void schedule_clock(void);
+static s32 clock_wait_us(void);
+static void set_clock_wait(u32 us);
+static void add_clock_time(u32 us);
+
+static void process_midi_cc(u8 cc, u8 value);
+#ifdef MIDI_SYNC
+static void midi_clock(void);
+static void midi_start(void);
+static void midi_stop(void);
+static u8 is_midi_clocked(void);
+#endif
 
 static void step(void);
+static void update_current_step(void);
+static u8 is_running(void);
 static void update_matrix(void);
+static void apply_note_changes(void);
 
 static void output_notes(void);
+static void output_voices(u32 due, u32 updated, u8 is_step);
 static void output_note(u8 n, u16 pitch, u16 vol, u8 on);
+static void retune_voices(s8 delta);
 static void stop_note(u8 n);
 static u8 note_gen(u8 n);
 static u16 note_vol(u8 n);
@@ -128,6 +330,7 @@ static void set_delay_width(u8 delay);
 static void set_note_delay(u8 n, u8 delay);
 
 static void transpose_step(void);
+static void update_transpose(void);
 static void toggle_transpose_seq(void);
 static void set_transpose(s8 trans);
 static void set_transpose_sel(u8 sel);
@@ -143,7 +346,31 @@ static void randomize_current_matrix(void);
 static void set_matrix_snapshot(u8 snapshot);
 static void toggle_matrix_cell(u8 in, u8 out);
 
+static void handle_event(u8 event, u8 *data, u8 length);
+static u8 is_queued_event(u8 event, u8 *data, u8 length);
+static u8 queue_event(u8 event, u8 *data, u8 length);
+static void drain_events(void);
+
 static void update_display(void);
+static void set_display_line(u8 line, const char *str, u8 colour);
+static void refresh_display(void);
+static void schedule_arc_refresh(void);
+static u8 arc_position(u8 enc);
+
+static u32 get_time(void);
+static u8 read_knob_count(void);
+static u16 read_knob(void);
+
+static void seed_random(u32 seed);
+static u32 next_random(u8 stream);
+static u32 random_range(u8 stream, u32 range);
+
+#ifdef EVENT_TRACE
+static void start_trace(void);
+static void record_event(u8 event, u8 *data, u8 length);
+static void dump_trace(void);
+static void put_trace_value(u8 *bytes, u8 offset, u32 value, u8 size);
+#endif
 
 static void process_gate(u8 index, u8 on);
 static void process_grid_press(u8 x, u8 y, u8 on);
@@ -153,7 +380,9 @@ static void process_grid_matrix(u8 x, u8 y, u8 on);
 static void process_grid_note_delay(u8 x, u8 y, u8 on);
 static void process_grid_i2c(u8 x, u8 y, u8 on);
 static void process_grid_presets(u8 x, u8 y, u8 on);
+static void process_arc(u8 enc, s16 delta);
 
+static void render_grid_page(void);
 static void render_trans_page(void);
 static void render_param_page(void);
 static void render_matrix_page(void);
@@ -161,6 +390,12 @@ static void render_note_delay_page(void);
 static void render_i2c_page(void);
 static void render_presets(void);
 
+static void fb_led(u8 x, u8 y, u8 level);
+static void fb_row(u8 y, u8 x1, u8 x2, u8 level);
+static void fb_rect(u8 x1, u8 y1, u8 x2, u8 y2, u8 level);
+static void blit_grid(void);
+
+static void print_hex_bytes(u8 *bytes, u8 length);
 static char* itoa(int value, char* result, int base);
 
 
@@ -171,59 +406,27 @@ void init_presets(void) {
     // called by main.c if there are no presets saved to flash yet
     // initialize meta - some meta data to be associated with a preset, like a glyph
     // initialize shared (any data that should be shared by all presets) with default values
-    // initialize preset with default values 
     // store them to flash
+    //
+    // presets are only written when they are saved for the first time. until
+    // then loading a slot gives the defaults from init_preset
     
     s.page = PAGE_PARAM;
     s.param = PARAM_LEN;
     s.mi = 0;
     for (u8 i = 0; i < MAX_DEVICE_COUNT; i++) s.i2c_device[i] = 0;
     s.run = 1;
+    s.voice_alloc = VOICE_ALLOC_DROP;
+    s.i2c_follower = 0;
+    for (u8 i = 0; i < MAXPRESETCOUNT / 8; i++) s.saved_presets[i] = 0;
+    s.version = FLASHVERSION;
     store_shared_data_to_flash(&s);
     
-    p.config.length = 8;
-    p.config.algoX = 1;
-    p.config.algoY = 1;
-    p.config.shift = 0;
-    p.config.space = 0;
-    
-    p.speed = 400;
-    p.gate_length = 200;
-    
-    p.swing = 0;
-    p.delay_width = 1;
-    for (u8 i = 0; i < NOTECOUNT; i++) p.note_delay[i] = 0;
-    
-    for (u8 i = 0; i < TRANSSEQLEN; i++) p.transpose[i] = 0;
-    p.transpose_seq_on = 0;
-    
-    for (u8 s = 0; s < SCALECOUNT; s++) {
-        for (u8 i = 0; i < SCALELEN; i++) p.scale_buttons[s][i] = 0;
-        p.scale_buttons[s][0] = p.scale_buttons[s][3] = p.scale_buttons[s][5] = p.scale_buttons[s][7] = 1;
-    }
-
-    p.octave = 0;
-    p.current_scale = 0;
-    
-    for (u8 i = 0; i < MATRIXCOUNT; i++) {
-        p.matrix_on[i] = 1;
-        p.m_snapshot[i] = 0;
-        for (u8 j = 0; j < MATRIXSNAPSHOTS; j++)
-            for (u8 k = 0; k < MATRIXINS; k++)
-                for (u8 l = 0; l < MATRIXOUTS; l++)
-                    p.matrix[i][j][k][l] = 0;
-    }
-    p.matrix_mode = MATRIXMODEEDIT;
-    
-    p.vol_index = 0;
-    p.vol_dir = VOL_DIR_OFF;
-    for (u8 i = 0; i < NOTECOUNT; i++) {
-        p.voice_vol[i][0] = p.voice_vol[i][1] = MAXVOLUMELEVEL;
-        p.voice_on[i] = 1;
-    }
-
-    for (u8 i = 0; i < get_preset_count(); i++)
+    // slots that don't fit the saved flags have to be written now
+    for (u8 i = MAXPRESETCOUNT; i < get_preset_count(); i++) {
+        init_preset(&p, i);
         store_preset_to_flash(i, &meta, &p);
+    }
 
     store_preset_index(0);
 }
@@ -233,22 +436,49 @@ void init_control(void) {
     // load current preset and its meta data
     
     load_shared_data_from_flash(&s);
+    if (s.version != FLASHVERSION) migrate_flash();
     load_preset(get_preset_index());
     
     // set up any other initial values and timers
 
     gate_length_mod = 0;
     
-    add_timed_event(CLOCKTIMER, 60000 / (p.speed ? p.speed : 1), 1);
+    set_clock_wait(clock_period_us());
+    schedule_clock();
+    if (get_knob_count()) knob_value = get_knob_value(0);
     add_timed_event(SPEEDTIMER, SPEEDCYCLE, 1);
     
-    set_as_i2c_leader();
     set_up_i2c();
+    
+    clear_screen();
+    update_display();
+    
+#ifdef EVENT_TRACE
+    start_trace();
+#endif
 }
 
 void process_event(u8 event, u8 *data, u8 length) {
+#ifdef EVENT_TRACE
+    record_event(event, data, length);
+#endif
+
+    // ui events go through a coalescing queue that is drained shortly after,
+    // or right after the next clock. clock, gate and timing events are
+    // handled immediately
+    
+    if (is_queued_event(event, data, length) && queue_event(event, data, length)) return;
+    
+    handle_event(event, data, length);
+    
+    if (event == MAIN_CLOCK_RECEIVED || (event == TIMED_EVENT && (data[0] == CLOCKTIMER || data[0] == QUEUETIMER)))
+        drain_events();
+}
+
+void handle_event(u8 event, u8 *data, u8 length) {
     switch (event) {
         case MAIN_CLOCK_RECEIVED:
+            external_clock();
             step();
             break;
         
@@ -260,6 +490,7 @@ void process_event(u8 event, u8 *data, u8 length) {
             break;
         
         case GRID_CONNECTED:
+            is_grid_shown = 0;
             break;
         
         case GRID_KEY_PRESSED:
@@ -270,6 +501,7 @@ void process_event(u8 event, u8 *data, u8 length) {
             break;
             
         case ARC_ENCODER_COARSE:
+            process_arc(data[0], data[1] ? 1 : -1);
             break;
     
         case FRONT_BUTTON_PRESSED:
@@ -290,6 +522,7 @@ void process_event(u8 event, u8 *data, u8 length) {
             break;
     
         case I2C_RECEIVED:
+            process_i2c(data, length);
             break;
             
         case TIMED_EVENT:
@@ -298,26 +531,60 @@ void process_event(u8 event, u8 *data, u8 length) {
             } else if (data[0] == SPEEDBUTTONTIMER) {
                 update_speed_from_buttons();
             } else if (data[0] == CLOCKTIMER) {
-                if (!is_external_clock_connected() && s.run) step();
+                internal_clock();
             } else if (data[0] == CLOCKOUTTIMER) {
                 set_clock_output(0);
+            } else if (data[0] == DISPLAYTIMER) {
+                refresh_display();
+            } else if (data[0] == QUEUETIMER) {
+                is_queue_pending = 0;
+            } else if (data[0] == SAVETIMER) {
+                continue_save();
+                if (!save_phase && is_bank_imported) apply_bank_shared();
+            } else if (data[0] == BANKTIMER) {
+                continue_export();
+            } else if (data[0] == ARCTIMER) {
+                is_arc_pending = 0;
+                refresh_arc();
+#ifdef EVENT_TRACE
+            } else if (data[0] == TRACETIMER) {
+                dump_trace();
+#endif
             } else if (data[0] >= NOTEDELAYTIMER && data[0] < GATETIMER) {
                 u8 n = data[0] - NOTEDELAYTIMER;
-                output_note(n, notes_pitch[n], notes_vol[n], notes_on[n]);
+                voices_pending &= ~((u32)1 << n);
+                voice_out_t *out = &voice_out[n][(voice_out_sel >> n) & 1];
+                output_note(n, out->pitch, out->vol, out->on);
             } else if (data[0] >= GATETIMER) {
                 stop_note(data[0] - GATETIMER);
             }
             break;
         
         case MIDI_CONNECTED:
+            if (!data[0]) midi_cc_on = 0;
             break;
         
         case MIDI_NOTE:
             break;
         
         case MIDI_CC:
+            process_midi_cc(data[1], data[2]);
+            break;
+            
+#ifdef MIDI_SYNC
+        case MIDI_CLOCK:
+            midi_clock();
             break;
             
+        case MIDI_START:
+            midi_start();
+            break;
+            
+        case MIDI_STOP:
+            midi_stop();
+            break;
+#endif
+            
         case MIDI_AFTERTOUCH:
             break;
             
@@ -335,6 +602,79 @@ void process_event(u8 event, u8 *data, u8 length) {
     }
 }
 
+#ifdef I2C_FOLLOWER_READ
+u8 get_i2c_response(u8 *request, u8 length, u8 *response) {
+    // called from the i2c interrupt when the leader reads. responses come from
+    // the state published by the last step, so this only copies bytes
+    
+    if (!s.i2c_follower || !length) return 0;
+    
+    u8 *state = i2c_state[i2c_state_index];
+    u8 index = length > 1 ? request[1] : 0;
+    
+    switch (request[0]) {
+        case I2C_GET_NOTE:
+            if (index >= NOTECOUNT) return 0;
+            response[0] = state[I2C_STATE_NOTES + index];
+            return 1;
+            
+        case I2C_GET_GATE:
+            if (index >= NOTECOUNT) return 0;
+            response[0] = state[I2C_STATE_GATES + index];
+            return 1;
+            
+        case I2C_GET_MOD_CV:
+            if (index >= MODCOUNT) return 0;
+            response[0] = state[I2C_STATE_MOD_CVS + index];
+            return 1;
+            
+        case I2C_GET_MOD_GATE:
+            if (index >= MODCOUNT) return 0;
+            response[0] = state[I2C_STATE_MOD_GATES + index];
+            return 1;
+            
+        case I2C_GET_STEP:
+            response[0] = state[I2C_STATE_STEP];
+            return 1;
+            
+        case I2C_GET_STATE:
+            memcpy(response, state, I2C_STATE_LEN);
+            return I2C_STATE_LEN;
+            
+        default:
+            return 0;
+    }
+}
+#endif
+
+#ifdef EVENT_TRACE
+void replay_trace(trace_header_t *header, trace_entry_t *entries, u16 count) {
+    // host builds only: call after init_control() to feed a recorded session
+    // back through process_event. the preset and the random seed are restored
+    // first, get_time() follows the recorded timestamps and the knob reads
+    // the recorded values, so the session plays back exactly as it was
+    // recorded, as long as nothing was dropped
+
+    is_replaying = 1;
+    replay_time = 0;
+    replay_header = header;
+    replay_entries = entries;
+    replay_count = count;
+    replay_knob_next = 0;
+    knob_value = header->knob;
+    load_preset(header->preset);
+    seed_random(header->seed);
+    
+    for (u16 i = 0; i < count; i++) {
+        replay_time += entries[i].delta;
+        if (entries[i].event != TRACE_KNOB_READ)
+            process_event(entries[i].event, entries[i].data, entries[i].length);
+    }
+    
+    is_replaying = 0;
+}
+#endif
+
 
 // ----------------------------------------------------------------------------
 // actions
@@ -350,29 +690,262 @@ void toggle_preset_page() {
     refresh_grid();
 }
 
+void init_preset(preset_data_t *preset, u8 index) {
+    preset->config.length = 8;
+    preset->config.algoX = 1;
+    preset->config.algoY = 1;
+    preset->config.shift = 0;
+    preset->config.space = 0;
+    
+    preset->speed = 400;
+    preset->gate_length = 200;
+    
+    preset->swing = 0;
+    preset->delay_width = 1;
+    for (u8 i = 0; i < NOTECOUNT; i++) preset->note_delay[i] = 0;
+    
+    for (u8 i = 0; i < TRANSSEQLEN; i++) preset->transpose[i] = 0;
+    preset->transpose_seq_on = 0;
+    
+    for (u8 s = 0; s < SCALECOUNT; s++) {
+        for (u8 i = 0; i < SCALELEN; i++) preset->scale_buttons[s][i] = 0;
+        preset->scale_buttons[s][0] = preset->scale_buttons[s][3] = preset->scale_buttons[s][5] = preset->scale_buttons[s][7] = 1;
+    }
+
+    preset->octave = 0;
+    preset->current_scale = 0;
+    
+    for (u8 i = 0; i < MATRIXCOUNT; i++) {
+        preset->matrix_on[i] = 1;
+        preset->m_snapshot[i] = 0;
+        for (u8 j = 0; j < MATRIXSNAPSHOTS; j++)
+            for (u8 k = 0; k < MATRIXINS; k++)
+                for (u8 l = 0; l < MATRIXOUTS; l++)
+                    preset->matrix[i][j][k][l] = 0;
+    }
+    preset->matrix_mode = MATRIXMODEEDIT;
+    
+    preset->vol_index = 0;
+    preset->vol_dir = VOL_DIR_OFF;
+    for (u8 i = 0; i < NOTECOUNT; i++) {
+        preset->voice_vol[i][0] = preset->voice_vol[i][1] = MAXVOLUMELEVEL;
+        preset->voice_on[i] = 1;
+    }
+    
+    preset->seed = PRESETSEED + index;
+}
+
+u8 is_preset_stored(u8 preset) {
+    if (preset >= MAXPRESETCOUNT) return 1;
+    return (s.saved_presets[preset >> 3] >> (preset & 7)) & 1;
+}
+
+void read_preset(u8 index, preset_data_t *preset) {
+    // a preset that is still being saved only counts once it's verified, and
+    // until then its flash may be half written
+    
+    if (save_phase != SAVE_IDLE && save_phase != SAVE_REVERT && index == save_index)
+        *preset = save_p;
+    else if (is_preset_stored(index))
+        load_preset_from_flash(index, preset);
+    else
+        init_preset(preset, index);
+}
+
 void save_preset() {
-    store_preset_to_flash(selected_preset, &meta, &p);
+    // writing to flash takes long enough to delay a clock tick, so the preset
+    // is copied now and written by continue_save in separate steps, each
+    // one right after a step when the next tick is furthest away
+    
+    start_save(selected_preset, &p);
+}
+
+void start_save(u8 index, preset_data_t *preset) {
+    // the slot is only marked as saved in flash once the preset is written,
+    // and here once it's verified. a pending save of another slot is
+    // finished first instead of being dropped
+    
+    if (save_phase && save_index != index) finish_save();
+    
+    save_p = *preset;
+    save_s = s;
+    save_index = index;
+    if (save_index < MAXPRESETCOUNT) save_s.saved_presets[save_index >> 3] |= 1 << (save_index & 7);
+    save_phase = SAVE_PRESET;
+    save_attempts = 0;
+    is_bank_saving = 0;
+    add_timed_event(SAVETIMER, step_period_us() / 1000 + SAVEIDLECYCLE, 0);
+}
+
+void migrate_flash() {
+    // flash written before FLASHVERSION, laid out as flash_layout_v0_t. it's
+    // read back through the current layout and the presets are converted
+    // from the last one down, as the new place of a preset only overlaps
+    // old presets after it. this writes every slot once, on the first boot
+    // after an update
+    
+    u8 count = get_preset_count();
+    
+    // the shared data may start later now, what's before it can't be read
+    shared_v0.page = PAGE_PARAM;
+    shared_v0.param = PARAM_LEN;
+    read_flash_v0(offsetof(flash_layout_v0_t, shared), (u8 *)&shared_v0, sizeof(shared_data_v0_t));
+    
+    for (u8 i = count; i-- > 0;) {
+        read_flash_v0(offsetof(flash_layout_v0_t, presets) + i * sizeof(preset_data_v0_t), (u8 *)&preset_v0, sizeof(preset_data_v0_t));
+        upgrade_preset(&preset_v0, &p, i);
+        store_preset_to_flash(i, &meta, &p);
+    }
+    
+    s.page = shared_v0.page;
+    s.param = shared_v0.param;
+    s.mi = shared_v0.mi;
+    for (u8 i = 0; i < MAX_DEVICE_COUNT; i++) s.i2c_device[i] = shared_v0.i2c_device[i];
+    s.run = shared_v0.run;
+    s.voice_alloc = VOICE_ALLOC_DROP;
+    s.i2c_follower = 0;
+    
+    // older versions wrote every slot when flash was initialized
+    for (u8 i = 0; i < MAXPRESETCOUNT / 8; i++) s.saved_presets[i] = 0xFF;
+    
+    s.version = FLASHVERSION;
     store_shared_data_to_flash(&s);
-    store_preset_index(selected_preset);
+}
+
+void read_flash_v0(u32 offset, u8 *data, u16 length) {
+    // reads length bytes at offset into the flash struct, loading the shared
+    // data or preset they are in now. bytes that are in neither are skipped
+    
+    u32 shared_start = offsetof(flash_layout_t, shared);
+    u32 presets_start = offsetof(flash_layout_t, presets);
+    u32 start, size, n;
+    u8 *record;
+    
+    while (length) {
+        if (offset >= presets_start && (offset - presets_start) / sizeof(preset_data_t) < get_preset_count()) {
+            u8 index = (offset - presets_start) / sizeof(preset_data_t);
+            load_preset_from_flash(index, &verify_p);
+            record = (u8 *)&verify_p;
+            start = presets_start + index * sizeof(preset_data_t);
+            size = sizeof(preset_data_t);
+        } else if (offset >= shared_start && offset < shared_start + sizeof(shared_data_t)) {
+            load_shared_data_from_flash(&verify_s);
+            record = (u8 *)&verify_s;
+            start = shared_start;
+            size = sizeof(shared_data_t);
+        } else {
+            offset++;
+            data++;
+            length--;
+            continue;
+        }
+        
+        n = start + size - offset;
+        if (n > length) n = length;
+        memcpy(data, record + (offset - start), n);
+        offset += n;
+        data += n;
+        length -= n;
+    }
+}
+
+void upgrade_preset(preset_data_v0_t *old, preset_data_t *preset, u8 index) {
+    // fields added since get their defaults
+    init_preset(preset, index);
+    
+    preset->config = old->config;
+    preset->speed = old->speed;
+    preset->gate_length = old->gate_length;
+    preset->swing = old->swing;
+    preset->delay_width = old->delay_width;
+    memcpy(preset->note_delay, old->note_delay, sizeof(old->note_delay));
+    memcpy(preset->transpose, old->transpose, sizeof(old->transpose));
+    preset->transpose_seq_on = old->transpose_seq_on;
+    memcpy(preset->scale_buttons, old->scale_buttons, sizeof(old->scale_buttons));
+    preset->current_scale = old->current_scale;
+    preset->octave = old->octave;
+    memcpy(preset->matrix, old->matrix, sizeof(old->matrix));
+    memcpy(preset->matrix_on, old->matrix_on, sizeof(old->matrix_on));
+    memcpy(preset->m_snapshot, old->m_snapshot, sizeof(old->m_snapshot));
+    preset->matrix_mode = old->matrix_mode;
+    preset->vol_index = old->vol_index;
+    preset->vol_dir = old->vol_dir;
+    memcpy(preset->voice_vol, old->voice_vol, sizeof(old->voice_vol));
+    memcpy(preset->voice_on, old->voice_on, sizeof(old->voice_on));
 }
 
 void save_preset_and_confirm() {
+    // the confirmation is shown by continue_save once the preset is verified
     save_preset();
     is_presets = 0;
-    is_preset_saved = 1;
     refresh_grid();
 }
 
+void continue_save() {
+    switch (save_phase) {
+        case SAVE_PRESET:
+            store_preset_to_flash(save_index, &meta, &save_p);
+            save_phase = SAVE_SHARED;
+            break;
+            
+        case SAVE_SHARED:
+            store_shared_data_to_flash(&save_s);
+            if (!is_bank_saving) store_preset_index(save_index);
+            save_phase = SAVE_VERIFY;
+            break;
+            
+        case SAVE_VERIFY:
+            load_preset_from_flash(save_index, &verify_p);
+            load_shared_data_from_flash(&verify_s);
+            if (!memcmp(&verify_p, &save_p, sizeof(preset_data_t)) && !memcmp(&verify_s, &save_s, sizeof(shared_data_t))) {
+                if (save_index < MAXPRESETCOUNT) s.saved_presets[save_index >> 3] |= 1 << (save_index & 7);
+                save_phase = SAVE_IDLE;
+                if (!is_bank_saving) {
+                    is_preset_saved = 1;
+                    refresh_grid();
+                }
+            } else {
+                save_phase = ++save_attempts < SAVEATTEMPTS ? SAVE_PRESET : SAVE_REVERT;
+            }
+            break;
+            
+        case SAVE_REVERT:
+            // the preset couldn't be verified, so flash must not mark it as
+            // saved either
+            store_shared_data_to_flash(&s);
+            save_phase = SAVE_IDLE;
+            break;
+            
+        default:
+            save_phase = SAVE_IDLE;
+            break;
+    }
+    
+    // the next step moves this to right after it. without a clock the save
+    // carries on by itself
+    if (save_phase) add_timed_event(SAVETIMER, step_period_us() / 1000 + SAVEIDLECYCLE, 0);
+}
+
+void finish_save() {
+    while (save_phase) continue_save();
+}
+
 void load_preset(u8 preset) {
     selected_preset = preset;
-    load_preset_from_flash(selected_preset, &p);
 
+    u32 prev_period = clock_period_us();
+    read_preset(selected_preset, &p);
+
+    seed_random(p.seed);
     initEngine(&p.config);
-    update_timer_interval(CLOCKTIMER, 60000 / (p.speed ? p.speed : 1));
+    apply_note_changes();
+    retime_clock(prev_period);
     updateScales(p.scale_buttons);
     setCurrentScale(p.current_scale >= SCALECOUNT ? 0 : p.current_scale);
+    update_transpose();
 
     refresh_grid();
+    schedule_arc_refresh();
 }
 
 void toggle_run_stop() {
@@ -389,6 +962,17 @@ void set_up_i2c() {
     for (u8 i = 0; i < NOTECOUNT; i++) map_voice(i, VOICE_DISTING_EX, i, 0);
     for (u8 i = 0; i < NOTECOUNT; i++) map_voice(i, VOICE_I2C2MIDI_1, i, 0);
     set_jf_mode(0);
+    
+    // as a follower the i2c devices can't be played
+    if (s.i2c_follower) {
+#ifdef I2C_FOLLOWER_READ
+        update_i2c_state();
+#endif
+        set_as_i2c_follower(I2C_FOLLOWER_ADDRESS);
+        return;
+    }
+    
+    set_as_i2c_leader();
 
     if (s.i2c_device[VOICE_JF]) {
         set_jf_mode(1);
@@ -427,6 +1011,79 @@ void toggle_i2c_device(u8 device) {
     refresh_grid();
 }
 
+void toggle_i2c_follower() {
+    s.i2c_follower = !s.i2c_follower;
+    set_up_i2c();
+    refresh_grid();
+}
+
+void process_i2c(u8 *data, u8 length) {
+    if (!s.i2c_follower || !length) return;
+    
+    u8 v = length > 1 ? data[1] : 0;
+    switch (data[0]) {
+        case I2C_SET_LENGTH:
+            if (length > 1) set_length(v < 1 ? 1 : v > 32 ? 32 : v);
+            break;
+        case I2C_SET_ALGOX:
+            if (length > 1) set_algoX(v > 127 ? 127 : v);
+            break;
+        case I2C_SET_ALGOY:
+            if (length > 1) set_algoY(v > 127 ? 127 : v);
+            break;
+        case I2C_SET_SHIFT:
+            if (length > 1) set_shift(v > 12 ? 12 : v);
+            break;
+        case I2C_SET_SPACE:
+            // the grid sets space with a column, 0 to 15
+            if (length > 1) set_space(v > GRIDCOLS - 1 ? GRIDCOLS - 1 : v);
+            break;
+        case I2C_SET_GATE_LENGTH:
+            if (length > 2) {
+                u16 len = (v << 8) | data[2];
+                set_gate_length(len < 20 ? 20 : len > 2000 ? 2000 : len);
+            }
+            break;
+        case I2C_RESET:
+            reset();
+            update_current_step();
+            break;
+        case I2C_BANK_EXPORT:
+            export_bank();
+            break;
+        case I2C_BANK_IMPORT:
+            import_bank();
+            break;
+        case I2C_BANK_DATA:
+            for (u8 i = 1; i < length; i++) import_bank_byte(data[i]);
+            break;
+        default:
+            break;
+    }
+}
+
+#ifdef I2C_FOLLOWER_READ
+void update_i2c_state() {
+    // fill the buffer the i2c interrupt isn't reading from and then switch,
+    // so a read never sees a half updated state
+    
+    u8 *state = i2c_state[!i2c_state_index];
+    
+    for (u8 n = 0; n < NOTECOUNT; n++) {
+        state[I2C_STATE_NOTES + n] = getNote(n, 0) + trans_offset;
+        state[I2C_STATE_GATES + n] = getGate(n, 0);
+    }
+    
+    for (u8 m = 0; m < MODCOUNT; m++) {
+        state[I2C_STATE_MOD_CVS + m] = getModCV(m);
+        state[I2C_STATE_MOD_GATES + m] = getModGate(m);
+    }
+    
+    state[I2C_STATE_STEP] = getCurrentStep();
+    i2c_state_index = !i2c_state_index;
+}
+#endif
+
 void set_vol_dir(u8 dir) {
     p.vol_dir = dir;
     refresh_grid();
@@ -448,10 +1105,37 @@ void set_vol_index(u8 index) {
     refresh_grid();
 }
 
+void set_voice_alloc(u8 alloc) {
+    s.voice_alloc = alloc;
+    refresh_grid();
+}
+
 void update_speed_from_knob() {
-    if (get_knob_count() == 0) return;
+    if (read_knob_count() == 0) return;
     
-    u32 speed = (((get_knob_value(0) * 1980) >> 19) << 3) + 20;
+    // the knob only takes over once it moves out of the dead band around the
+    // last accepted value, so jitter never reprograms the clock. while it's
+    // left alone it's polled at a much lower rate
+    
+    // readings within the dead band of either end count as the end itself,
+    // so the ends are always reachable but a knob parked there stays idle
+    
+    u16 value = read_knob();
+    if (value <= KNOBDEADBAND) value = 0;
+    else if (value >= KNOBMAX - KNOBDEADBAND) value = KNOBMAX;
+    u16 delta = value > knob_value ? value - knob_value : knob_value - value;
+    
+    if (delta <= KNOBDEADBAND) {
+        if (knob_idle < SPEEDIDLECOUNT && ++knob_idle == SPEEDIDLECOUNT)
+            update_timer_interval(SPEEDTIMER, SPEEDIDLECYCLE);
+        return;
+    }
+    
+    if (knob_idle >= SPEEDIDLECOUNT) update_timer_interval(SPEEDTIMER, SPEEDCYCLE);
+    knob_idle = 0;
+    knob_value = value;
+    
+    u32 speed = (((value * 1980) >> 19) << 3) + 20;
     update_speed(speed);
 }
 
@@ -468,63 +1152,277 @@ void update_speed(u32 speed) {
     if (speed > 2000) speed = 2000; else if (speed < 20) speed = 20;
     
     if (speed != p.speed) {
+        u32 prev_period = clock_period_us();
         p.speed = speed;
-        update_timer_interval(CLOCKTIMER, 60000 / speed);
+        clock_fraction = 0;
+        retime_clock(prev_period);
         update_display();
+        schedule_arc_refresh();
     }
 }
 
+u32 step_period_us() {
+#ifdef MIDI_SYNC
+    if (is_midi_clocked() && midi_clock_period) return midi_clock_period;
+#endif
+    if (is_external_clock_connected() && ext_clock_period) return ext_clock_period;
+    return clock_period_us();
+}
+
+u32 clock_period_us() {
+    return 60000000 / (p.speed ? p.speed : 1);
+}
+
+void external_clock() {
+    // estimate the external clock period as the median of the last 3 edge
+    // intervals, which ignores a single late or doubled edge and costs only
+    // a few comparisons per edge
+    
+    u32 now = get_time();
+    u32 interval = now - ext_clock_last;
+    ext_clock_last = now;
+    
+    if (interval > EXTCLOCKTIMEOUT) {
+        ext_clock_period = 0;
+        ext_clock_index = 0;
+        return;
+    }
+    
+    ext_clock_intervals[ext_clock_index % 3] = interval * 1000;
+    if (++ext_clock_index < 3) {
+        ext_clock_period = interval * 1000;
+        return;
+    }
+    ext_clock_index = 3;
+    
+    u32 a = ext_clock_intervals[0], b = ext_clock_intervals[1], c = ext_clock_intervals[2];
+    if (a > b) { u32 t = a; a = b; b = t; }
+    if (b > c) b = c;
+    ext_clock_period = a > b ? a : b;
+}
+
+void internal_clock() {
+    // the time of the next tick is accumulated in microseconds, with the
+    // fraction of a microsecond carried in units of 1/speed, and each tick is
+    // scheduled against the global time, so rounding never turns into drift
+    
+    u32 period = clock_period_us();
+    u32 speed = p.speed ? p.speed : 1;
+    
+    if (clock_wait_us() + (s32)period < 0) set_clock_wait(0);
+    add_clock_time(period);
+    clock_fraction += 60000000 % speed;
+    if (clock_fraction >= speed) {
+        clock_fraction -= speed;
+        add_clock_time(1);
+    }
+    schedule_clock();
+    
+#ifdef MIDI_SYNC
+    if (is_midi_clocked()) return;
+#endif
+    if (!is_external_clock_connected() && s.run) step();
+}
+
+void retime_clock(u32 prev_period) {
+    // keep the phase within the current step when the speed changes
+    
+    s32 wait = clock_wait_us();
+    if (wait > 0) set_clock_wait((u64)wait * clock_period_us() / (prev_period ? prev_period : 1));
+    schedule_clock();
+}
+
+void schedule_clock() {
+    s32 wait = clock_wait_us();
+    u32 delay = wait > 0 ? (wait + 999) / 1000 : 1;
+    add_timed_event(CLOCKTIMER, delay, 0);
+}
+
+// the next tick is kept as a time in milliseconds plus microseconds, and
+// only the difference to the millisecond time is ever used, so the clock
+// carries on when that time wraps after 49 days
+
+s32 clock_wait_us() {
+    // limited to 1000s either way, which fits in microseconds
+    s32 ms = clock_next_ms - get_time();
+    if (ms > 1000000) ms = 1000000; else if (ms < -1000000) ms = -1000000;
+    return ms * 1000 + clock_next_us;
+}
+
+void set_clock_wait(u32 us) {
+    clock_next_ms = get_time() + us / 1000;
+    clock_next_us = us % 1000;
+}
+
+void add_clock_time(u32 us) {
+    us += clock_next_us;
+    clock_next_ms += us / 1000;
+    clock_next_us = us % 1000;
+}
+
 void step() {
     clock();
+    apply_note_changes();
     transpose_step();
     output_notes();
     output_mods();
     output_clock();
     update_matrix();
+#ifdef I2C_FOLLOWER_READ
+    if (s.i2c_follower) update_i2c_state();
+#endif
+    if (save_phase) add_timed_event(SAVETIMER, 1, 0);
+    if (is_bank_exporting) add_timed_event(BANKTIMER, 1, 0);
+    refresh_grid();
+}
+
+void update_current_step() {
+    // recalculates the step after a reset or scale change between clocks.
+    // voices playing the current generation are sent out right away if
+    // their note or gate changed, delayed voices still play from history
+    
+    u32 changed = recalculate(), due = 0;
+    for (u8 n = 0; n < NOTECOUNT; n++) {
+        current_notes[n] = getNote(n, 0);
+        current_gates[n] = getGate(n, 0);
+        if (!note_gen(n)) due |= changed & ((u32)1 << n);
+    }
+    
+    output_voices(is_running() ? due : 0, changed, 0);
+#ifdef I2C_FOLLOWER_READ
+    if (s.i2c_follower) update_i2c_state();
+#endif
     refresh_grid();
 }
 
+u8 is_running() {
+    return s.run || is_external_clock_connected();
+}
+
 void transpose_step() {
     if (p.transpose_seq_on && isReset()) {
         trans_step = (trans_step + 1) % TRANSSEQLEN;
+        update_transpose();
         refresh_grid();
     }
 }
 
+void update_transpose(void) {
+    // transpose and octave only change on edits and transpose sequence steps,
+    // so they are folded into a single offset that is added to each note
+    
+    trans_offset = 12 + p.transpose[trans_step];
+    if (p.octave > 0) trans_offset += 12;
+    else if (p.octave < 0 && trans_offset >= 12) trans_offset -= 12;
+}
+
+void apply_note_changes(void) {
+    // keep the current note and gate of each voice from the changes the
+    // engine pushed for this step
+    
+    const noteChange_t *changes = getChanges(0);
+    for (u8 i = getChangeCount(0); i--;) {
+        current_notes[changes[i].voice] = changes[i].note;
+        current_gates[changes[i].voice] = changes[i].gate;
+    }
+}
+
 void output_notes(void) {
-    u8 trans = 12 + p.transpose[trans_step];
-    if (p.octave > 0) trans += 12;
-    else if (p.octave < 0 && trans >= 12) trans -= 12;
+    // a voice only plays if its gate changed in the generation it plays
+    // from, and only needs its slot updated if that or its current note
+    // changed. both come from the engine's change lists, so voices after the
+    // last of those aren't visited at all
+    
+    u32 due = 0, updated = 0;
+    for (u8 gen = 0; gen < HISTORYCOUNT; gen++) {
+        const noteChange_t *changes = getChanges(gen);
+        for (u8 i = getChangeCount(gen); i--;) {
+            if (note_gen(changes[i].voice) == gen) due |= (u32)1 << changes[i].voice;
+            if (!gen) updated |= (u32)1 << changes[i].voice;
+        }
+    }
+    
+    output_voices(due, updated | due, 1);
+}
 
-    u8 prev_notes[NOTECOUNT];
-    u8 found;
+void output_voices(u32 due, u32 updated, u8 is_step) {
+    // notes a semitone away from a note of a lower voice are not played. the
+    // notes of all previous voices are kept in a pitch occupancy bitmap, so
+    // finding a neighbour is a single test whatever the number of voices
     
-    u8 gen;
+    u64 occupied = 0;
+    u8 owners[PITCHCOUNT];
+    u8 gen, note, pitch;
     
-    for (u8 n = 0; n < NOTECOUNT; n++) {
+    for (u8 n = 0; n < NOTECOUNT && (updated >> n); n++) {
         gen = note_gen(n);
-        prev_notes[n] = getNote(n, gen);
+        note = pitch = getNote(n, gen) % PITCHCOUNT;
         
-        found = 0;
-        for (u8 i = 0; i < n; i++)
-            if (prev_notes[n] == prev_notes[i] + 1 || prev_notes[n] == prev_notes[i] - 1) {
-                found = 1;
-                break;
+        u64 neighbours = (occupied << 1) | (occupied >> 1);
+        u8 found = (neighbours >> note) & 1;
+        occupied |= (u64)1 << note;
+        owners[note] = n;
+        
+        if (!((updated >> n) & 1)) continue;
+        
+        // fill the slot timers aren't using, it's switched in below before
+        // a timer for this voice can be started
+        voice_out_t *out = &voice_out[n][!((voice_out_sel >> n) & 1)];
+        *out = voice_out[n][(voice_out_sel >> n) & 1];
+        out->note = current_notes[n];
+        
+        if (!p.voice_on[n] || !((due >> n) & 1)) {
+            voice_out_sel ^= (u32)1 << n;
+            continue;
+        }
+        
+        if (found && s.voice_alloc == VOICE_ALLOC_REDIRECT) {
+            // move the note an octave up if that's clear
+            pitch = note + 12;
+            if (pitch < PITCHCOUNT && !((neighbours >> pitch) & 1) && !((occupied >> pitch) & 1)) {
+                occupied |= (u64)1 << pitch;
+                owners[pitch] = n;
+                found = 0;
+            }
+        } else if (found && s.voice_alloc == VOICE_ALLOC_STEAL) {
+            // silence the lower voices that hold the neighbouring notes and
+            // free their pitches, so later voices aren't checked against them
+            for (u8 other = note ? note - 1 : note + 1; other <= note + 1 && other < PITCHCOUNT; other += 2) {
+                if (!((occupied >> other) & 1)) continue;
+                stop_note(owners[other]);
+                occupied &= ~((u64)1 << other);
             }
+            found = 0;
+        }
+        
+        if (found) {
+            voice_out_sel ^= (u32)1 << n;
+        } else {
+            out->pitch = pitch + trans_offset;
+            out->vol = note_vol(n);
+            out->on = getGate(n, gen);
+            voice_out_sel ^= (u32)1 << n;
             
-        if (p.voice_on[n] && getGateChanged(n, gen) && !found) {
-            notes_pitch[n] = getNote(n, gen) + trans;
-            notes_vol[n] = note_vol(n);
-            notes_on[n] = getGate(n, gen);
             u32 ndel = (p.delay_width * p.note_delay[n]) % 8;
             if (getCurrentStep() & 1) ndel += p.swing;
             
-            if (ndel) {
-                u32 delay = (60000 * ndel) / (u32)((p.speed ? p.speed : 1) * 8);
-                if (!delay) delay = 1;
+            // timers only have 1ms resolution, so the delay is calculated in
+            // microseconds and the remainder is carried over to the next note
+            // on this voice, which keeps the average delay exact at any speed
+            u32 delay = 0;
+            if (is_step && ndel) {
+                delay = step_period_us() * ndel / 8 + notes_delay_error[n];
+                notes_delay_error[n] = delay % 1000;
+                delay /= 1000;
+            }
+            
+            // between clocks a note still waiting for its delay picks up the
+            // new slot when its timer fires, so only the others go out now
+            if (delay) {
+                voices_pending |= (u32)1 << n;
                 add_timed_event(NOTEDELAYTIMER + n, delay, 0);
-            } else {
-                output_note(n, notes_pitch[n], notes_vol[n], notes_on[n]);
+            } else if (is_step || !((voices_pending >> n) & 1)) {
+                output_note(n, out->pitch, out->vol, out->on);
             }
         }
     }
@@ -532,13 +1430,43 @@ void output_notes(void) {
 
 void output_note(u8 n, u16 pitch, u16 vol, u8 on) {
     note(n, pitch, vol, on);
-    add_timed_event(GATETIMER + n, gate_length_mod, 0);
+    if (on) voices_sounding |= (u32)1 << n; else voices_sounding &= ~((u32)1 << n);
+    
+    // gate length is set relative to the internal speed, so scale it to the
+    // actual step length when following an external or MIDI clock
+    u32 len = gate_length_mod, period = step_period_us(), internal = clock_period_us();
+    if (period != internal) len = (u64)len * period / internal;
+    if (len > 0xFFFF) len = 0xFFFF; else if (!len) len = 1;
+    add_timed_event(GATETIMER + n, len, 0);
+}
+
+void retune_voices(s8 delta) {
+    // moves the notes that are waiting or still sounding by a change in
+    // transposition. a waiting note plays from its slot when its timer fires,
+    // a sounding one only gets the new pitch, so its gate isn't started again
+    // and keeps its length
+    
+    if (!delta) return;
+    
+    for (u8 n = 0; n < NOTECOUNT; n++) {
+        u8 is_pending = (voices_pending >> n) & 1, is_sounding = (voices_sounding >> n) & 1;
+        if (!is_pending && !is_sounding) continue;
+        
+        voice_out_t *out = &voice_out[n][!((voice_out_sel >> n) & 1)];
+        *out = voice_out[n][(voice_out_sel >> n) & 1];
+        out->pitch += delta;
+        voice_out_sel ^= (u32)1 << n;
+        
+        if (!is_pending) note(n, out->pitch, out->vol, 1);
+    }
 }
 
 void stop_note(u8 n) {
     stop_timed_event(NOTEDELAYTIMER + n);
     stop_timed_event(GATETIMER + n);
-    note(n, getNote(n, 0), 0, 0);
+    voices_pending &= ~((u32)1 << n);
+    voices_sounding &= ~((u32)1 << n);
+    note(n, voice_out[n][(voice_out_sel >> n) & 1].note, 0, 0);
 }
 
 u8 note_gen(u8 n) {
@@ -553,7 +1481,7 @@ u16 note_vol(u8 n) {
     if (p.vol_dir == VOL_DIR_RAND) {
         u16 min = (min(p.voice_vol[n][0], p.voice_vol[n][1]) + 1) * 1000;
         u16 max = (max(p.voice_vol[n][0], p.voice_vol[n][1]) + 1) * 1000;
-        volume = (rand() % (max - min + 1)) + min;
+        volume = random_range(n, max - min + 1) + min;
     } else if (p.vol_dir == VOL_DIR_FLIP) {
         volume = 1000 * (p.voice_vol[n][reset_phase] + 1);
     } else if (p.vol_dir == VOL_DIR_SLEW) {
@@ -595,7 +1523,7 @@ void update_matrix(void) {
         for (u8 i = 0; i < 4; i++) {
             if (p.matrix_on[0]) {
                 counts[m] += p.matrix[0][p.m_snapshot[0]][i][m];
-                matrix_values[m] += getNote(i, 0) * p.matrix[0][p.m_snapshot[0]][i][m];
+                matrix_values[m] += current_notes[i] * p.matrix[0][p.m_snapshot[0]][i][m];
             }
             
             if (p.matrix_on[1]) {
@@ -607,7 +1535,7 @@ void update_matrix(void) {
         for (u8 i = 0; i < 2; i++) {
             if (p.matrix_on[0]) {
                 counts[m] += p.matrix[0][p.m_snapshot[0]][i + 4][m];
-                matrix_values[m] += getGate(i, 0) * p.matrix[0][p.m_snapshot[0]][i + 4][m] * MATRIXGATEWEIGHT;
+                matrix_values[m] += current_gates[i] * p.matrix[0][p.m_snapshot[0]][i + 4][m] * MATRIXGATEWEIGHT;
             }
             
             if (p.matrix_on[1]) {
@@ -625,6 +1553,13 @@ void update_matrix(void) {
             counts[m]++;
             matrix_values[m] += reset_phase * MATRIXGATEWEIGHT;
         }
+        
+        // CCs count as one more source, scaled to the range of a note input
+        u8 cc = m - MIDICCOUT;
+        if (cc < MIDICCCOUNT && (midi_cc_on & (1 << cc))) {
+            counts[m]++;
+            matrix_values[m] += (midi_cc[cc] * 120 * MATRIXMAXSTATE) >> 7;
+        }
     }
     
     u32 v;
@@ -697,6 +1632,7 @@ void set_current_scale(u8 scale) {
 
 void set_octave(s8 octave) {
     p.octave = octave;
+    update_transpose();
     refresh_grid();
 }
 
@@ -753,8 +1689,11 @@ void clear_current_matrix() {
     
 void randomize_current_matrix() {
     clear_current_matrix();
-    for (u8 i = 0; i < 10; i++)
-        p.matrix[s.mi][p.m_snapshot[s.mi]][rand() % MATRIXINS][(rand() % (MATRIXOUTS - 1)) + 1] = 1;
+    for (u8 i = 0; i < 10; i++) {
+        u8 in = random_range(RANDCONTROL, MATRIXINS);
+        u8 out = random_range(RANDCONTROL, MATRIXOUTS - 1) + 1;
+        p.matrix[s.mi][p.m_snapshot[s.mi]][in][out] = 1;
+    }
     refresh_grid();
 }
 
@@ -773,30 +1712,38 @@ void set_length(u8 length) {
     p.config.length = length;
     updateLength(p.config.length);
     if (s.page == PAGE_PARAM && s.param == PARAM_LEN) refresh_grid();
+    update_display();
+    schedule_arc_refresh();
 }
 
 void set_algoX(u8 algoX) {
     p.config.algoX = algoX;
     updateAlgoX(p.config.algoX);
     if (s.page == PAGE_PARAM && s.param == PARAM_ALGOX) refresh_grid();
+    update_display();
+    schedule_arc_refresh();
 }
 
 void set_algoY(u8 algoY) {
     p.config.algoY = algoY;
     updateAlgoY(p.config.algoY);
     if (s.page == PAGE_PARAM && s.param == PARAM_ALGOY) refresh_grid();
+    update_display();
+    schedule_arc_refresh();
 }
 
 void set_shift(u8 shift) {
     p.config.shift = shift;
     updateShift(p.config.shift);
     if (s.page == PAGE_PARAM && s.param == PARAM_SHIFT) refresh_grid();
+    update_display();
 }
 
 void set_space(u8 space) {
     p.config.space = space;
     updateSpace(p.config.space);
     if (s.page == PAGE_PARAM && s.param == PARAM_SPACE) refresh_grid();
+    update_display();
 }
 
 void set_gate_length(u16 len) {
@@ -828,6 +1775,7 @@ void toggle_transpose_seq() {
 
 void set_transpose(s8 trans) {
     p.transpose[trans_sel] = trans;
+    update_transpose();
     refresh_grid();
 }
 
@@ -838,6 +1786,7 @@ void set_transpose_sel(u8 sel) {
 
 void set_transpose_step(u8 step) {
     trans_step = step;
+    update_transpose();
     refresh_grid();
 }
 
@@ -846,37 +1795,92 @@ void set_transpose_step(u8 step) {
 // controller
 
 void update_display() {
-    clear_screen();
-    draw_str("ORCA'S HEART", 0, 15, 0);
-    
     // TODO format better
 
     char s[8];
 
+    set_display_line(0, "ORCA'S HEART", 15);
     itoa(p.config.length, s, 10);
-    draw_str(s, 2, 9, 0);
+    set_display_line(2, s, 9);
     itoa(p.config.algoX, s, 10);
-    draw_str(s, 3, 9, 0);
+    set_display_line(3, s, 9);
     itoa(p.config.algoY, s, 10);
-    draw_str(s, 4, 9, 0);
+    set_display_line(4, s, 9);
     itoa(p.config.shift, s, 10);
-    draw_str(s, 5, 9, 0);
+    set_display_line(5, s, 9);
     itoa(p.config.space, s, 10);
-    draw_str(s, 5, 9, 0);
+    set_display_line(6, s, 9);
+    
+    // lines are sent at most once per DISPLAYCYCLE, and only if they changed
+    if (display_dirty && !is_display_pending) {
+        is_display_pending = 1;
+        add_timed_event(DISPLAYTIMER, DISPLAYCYCLE, 0);
+    }
+}
+
+void set_display_line(u8 line, const char *str, u8 colour) {
+    if (display_colours[line] == colour && !strncmp(display_lines[line], str, DISPLAYLINELEN - 1)) return;
     
+    strncpy(display_lines[line], str, DISPLAYLINELEN - 1);
+    display_lines[line][DISPLAYLINELEN - 1] = 0;
+    display_colours[line] = colour;
+    display_dirty |= 1 << line;
+}
+
+void refresh_display() {
+    is_display_pending = 0;
+    if (!display_dirty) return;
+    
+    for (u8 line = 0; line < DISPLAYLINES; line++) {
+        if (!(display_dirty & (1 << line))) continue;
+        fill_line(line, 0);
+        draw_str(display_lines[line], line, display_colours[line], 0);
+    }
+    
+    display_dirty = 0;
     refresh_screen();
 }
 
+void schedule_arc_refresh() {
+    // arc updates are coalesced, so fast turns send at most one frame per
+    // ARCREFRESHCYCLE
+    
+    if (is_arc_pending) return;
+    is_arc_pending = 1;
+    add_timed_event(ARCTIMER, ARCREFRESHCYCLE, 0);
+}
+
+u8 arc_position(u8 enc) {
+    switch (enc) {
+        case 0:
+            return p.config.length * 2;
+        case 1:
+            return (p.config.algoX + 1) >> 1;
+        case 2:
+            return (p.config.algoY + 1) >> 1;
+        case 3:
+            return ((p.speed - 20) * (ARCLEDS - 1)) / 1980 + 1;
+        default:
+            return 0;
+    }
+}
+
 void process_gate(u8 index, u8 on) {
+    u8 offset;
+    
     switch (index) {
         case 0:
             reset();
+            update_current_step();
             break;
         case 1:
             toggle_scale();
+            update_current_step();
             break;
         case 2:
+            offset = trans_offset;
             toggle_octave();
+            retune_voices(trans_offset - offset);
             break;
         default:
             break;
@@ -975,14 +1979,16 @@ void process_grid_press(u8 x, u8 y, u8 on) {
 void render_grid() {
     if (!is_grid_connected()) return;
     
-    clear_all_grid_leds();
-    
+    memset(grid_fb, 0, sizeof(grid_fb));
+    render_grid_page();
+    blit_grid();
+}
+
+void render_grid_page() {
     if (is_preset_saved) {
-        for (u8 x = 6; x < 10; x++)
-            for (u8 y = 2; y < 6; y++)
-                set_grid_led(x, y, 10);
-        set_grid_led(7, 4, 0);
-        set_grid_led(8, 4, 0);
+        fb_rect(6, 2, 9, 5, 10);
+        fb_led(7, 4, 0);
+        fb_led(8, 4, 0);
         return;
     }
     
@@ -993,28 +1999,28 @@ void render_grid() {
     
     u8 on = 15, off = 7;
     
-    set_grid_led(0, 0, s.page == PAGE_MATRIX && s.mi == 0 ? on : off);
-    set_grid_led(1, 0, s.page == PAGE_MATRIX && s.mi == 1 ? on : off);
-    set_grid_led(0, 1, p.matrix_on[0] ? off : off - 4);
-    set_grid_led(1, 1, p.matrix_on[1] ? off : off - 4);
+    fb_led(0, 0, s.page == PAGE_MATRIX && s.mi == 0 ? on : off);
+    fb_led(1, 0, s.page == PAGE_MATRIX && s.mi == 1 ? on : off);
+    fb_led(0, 1, p.matrix_on[0] ? off : off - 4);
+    fb_led(1, 1, p.matrix_on[1] ? off : off - 4);
     
-    set_grid_led(2, 0, s.page == PAGE_TRANS ? on : off);
-    set_grid_led(15, 1, p.transpose_seq_on ? off : off - 4);
+    fb_led(2, 0, s.page == PAGE_TRANS ? on : off);
+    fb_led(15, 1, p.transpose_seq_on ? off : off - 4);
     
-    set_grid_led(14, 0, s.page == PAGE_N_DEL ? on : off);
-    set_grid_led(15, 0, s.page == PAGE_I2C ? on : off);
+    fb_led(14, 0, s.page == PAGE_N_DEL ? on : off);
+    fb_led(15, 0, s.page == PAGE_I2C ? on : off);
     
     if (s.page == PAGE_I2C) {
         render_i2c_page();
         return;
     }
 
-    set_grid_led(4, 0, s.page == PAGE_PARAM && s.param == PARAM_LEN ? on : off);
-    set_grid_led(5, 0, s.page == PAGE_PARAM && s.param == PARAM_ALGOX ? on : off);
-    set_grid_led(6, 0, s.page == PAGE_PARAM && s.param == PARAM_ALGOY ? on : off);
-    set_grid_led(7, 0, s.page == PAGE_PARAM && s.param == PARAM_SHIFT ? on : off);
-    set_grid_led(8, 0, s.page == PAGE_PARAM && s.param == PARAM_SPACE ? on : off);
-    set_grid_led(9, 0, s.page == PAGE_PARAM && s.param == PARAM_GATEL ? on : off);
+    fb_led(4, 0, s.page == PAGE_PARAM && s.param == PARAM_LEN ? on : off);
+    fb_led(5, 0, s.page == PAGE_PARAM && s.param == PARAM_ALGOX ? on : off);
+    fb_led(6, 0, s.page == PAGE_PARAM && s.param == PARAM_ALGOY ? on : off);
+    fb_led(7, 0, s.page == PAGE_PARAM && s.param == PARAM_SHIFT ? on : off);
+    fb_led(8, 0, s.page == PAGE_PARAM && s.param == PARAM_SPACE ? on : off);
+    fb_led(9, 0, s.page == PAGE_PARAM && s.param == PARAM_GATEL ? on : off);
     
     if (s.page == PAGE_TRANS) render_trans_page();
     else if (s.page == PAGE_PARAM) render_param_page();
@@ -1022,6 +2028,37 @@ void render_grid() {
     else if (s.page == PAGE_N_DEL) render_note_delay_page();
 }
 
+void process_arc(u8 enc, s16 delta) {
+    // delta is the number of ticks, more than one when queued ticks were
+    // added together
+    
+    s32 v;
+    
+    switch (enc) {
+        case 0:
+            v = p.config.length + delta;
+            if (v < 1) v = 1; else if (v > 32) v = 32;
+            if (v != p.config.length) set_length(v);
+            break;
+        case 1:
+            v = p.config.algoX + delta;
+            if (v < 0) v = 0; else if (v > 127) v = 127;
+            if (v != p.config.algoX) set_algoX(v);
+            break;
+        case 2:
+            v = p.config.algoY + delta;
+            if (v < 0) v = 0; else if (v > 127) v = 127;
+            if (v != p.config.algoY) set_algoY(v);
+            break;
+        case 3:
+            v = p.speed + delta * ARCSPEEDSTEP;
+            update_speed(v < 0 ? 0 : v);
+            break;
+        default:
+            break;
+    }
+}
+
 void process_grid_presets(u8 x, u8 y, u8 on) {
     if (!on) return;
     
@@ -1040,17 +2077,10 @@ void process_grid_presets(u8 x, u8 y, u8 on) {
 void render_presets() {
     u8 on = 7;
     
-    for (u8 x = 4; x < 12; x++) {
-        set_grid_led(x, 1, on);
-        set_grid_led(x, 2, on);
-    }
-        
-    for (u8 x = 4; x < 12; x++) {
-        set_grid_led(x, 5, on);
-        set_grid_led(x, 6, on);
-    }
+    fb_rect(4, 1, 11, 2, on);
+    fb_rect(4, 5, 11, 6, on);
 
-    set_grid_led((selected_preset % 8) + 4, 5 + selected_preset / 8, 15);
+    fb_led((selected_preset % 8) + 4, 5 + selected_preset / 8, 15);
 }
 
 void process_grid_trans(u8 x, u8 y, u8 on) {
@@ -1091,46 +2121,38 @@ void process_grid_trans(u8 x, u8 y, u8 on) {
 void render_trans_page() {
     u8 on = 15, mod = 6, off = 3, soff = 1;
 
-    set_grid_led(0, 4, off);
-    set_grid_led(0, 5, off);
-    set_grid_led(0, 6, off);
-    set_grid_led(0, 7, off);
-    set_grid_led(0, getCurrentScale() + 4, on);
+    fb_rect(0, 4, 0, 7, off);
+    fb_led(0, getCurrentScale() + 4, on);
     
-    set_grid_led(15, 4, off);
-    set_grid_led(15, 5, off);
-    set_grid_led(15, 6, off);
-    set_grid_led(15, 7, off);
+    fb_rect(15, 4, 15, 7, off);
 
     for (u8 i = 0; i < SCALECOUNT; i++) {
         for (u8 j = 0; j < SCALELEN; j++)
-            set_grid_led(2 + j, i + 4, p.scale_buttons[i][j] ? on : (j == 0 || j == SCALELEN - 1 ? off : soff));
+            fb_led(2 + j, i + 4, p.scale_buttons[i][j] ? on : (j == 0 || j == SCALELEN - 1 ? off : soff));
     }
     
     u8 p1 = 8 - TRANSSEQLEN / 2;
-    for (u8 i = 0; i < TRANSSEQLEN; i++) set_grid_led(i + p1, 1, off);
-    set_grid_led(trans_sel + p1, 1, mod);
-    set_grid_led(trans_step + p1, 1, on);
+    fb_row(1, p1, p1 + TRANSSEQLEN - 1, off);
+    fb_led(trans_sel + p1, 1, mod);
+    fb_led(trans_step + p1, 1, on);
 
-    for (u8 y = 2; y < 4; y++)
-        for (u8 x = 0; x < 16; x++)
-            set_grid_led(x, y, off);
+    fb_rect(0, 2, 15, 3, off);
         
-    set_grid_led(0, 2, p.octave == -1 ? on : mod);
-    set_grid_led(15, 3, p.octave == 1 ? on : mod);
+    fb_led(0, 2, p.octave == -1 ? on : mod);
+    fb_led(15, 3, p.octave == 1 ? on : mod);
     
-    set_grid_led(15, 2, p.transpose[trans_sel] ? mod : on);
-    set_grid_led(0, 3, p.transpose[trans_sel] ? mod : on);
+    fb_led(15, 2, p.transpose[trans_sel] ? mod : on);
+    fb_led(0, 3, p.transpose[trans_sel] ? mod : on);
     
     if (p.transpose[trans_step] < 0)
-        set_grid_led(15 + p.transpose[trans_step], 2, mod);
+        fb_led(15 + p.transpose[trans_step], 2, mod);
     else if (p.transpose[trans_step])
-        set_grid_led(p.transpose[trans_step], 3, mod);
+        fb_led(p.transpose[trans_step], 3, mod);
 
     if (p.transpose[trans_sel] < 0)
-        set_grid_led(15 + p.transpose[trans_sel], 2, on);
+        fb_led(15 + p.transpose[trans_sel], 2, on);
     else if (p.transpose[trans_sel])
-        set_grid_led(p.transpose[trans_sel], 3, on);
+        fb_led(p.transpose[trans_sel], 3, on);
 }
 
 void process_grid_param(u8 x, u8 y, u8 on) {
@@ -1181,55 +2203,55 @@ void render_param_page() {
     switch (s.param) {
         
         case PARAM_LEN:
-            for (u8 x = 0; x < 16; x++) for (u8 y = 3; y < 5; y++) set_grid_led(x, y, off);
+            fb_rect(0, 3, 15, 4, off);
             
             y = y2 = 3;
             p1 = p.config.length - 1;
             if (p1 > 16) { y = 4; p1 -= 16; }
             p2 = getLength() - 1;
             if (p2 > 16) { y2 = 4; p2 -= 16; }
-            set_grid_led(p2, y2, mod);
-            set_grid_led(p1, y, on);
+            fb_led(p2, y2, mod);
+            fb_led(p1, y, on);
             break;
         
         case PARAM_ALGOX:
             p1 = (p.config.algoX >> 4);
             p2 = (getAlgoX() >> 4);
-            for (u8 i = 0; i < 8; i++) set_grid_led(i + 4, 3, i == p1 ? on : (i == p2 ? mod : off));
+            for (u8 i = 0; i < 8; i++) fb_led(i + 4, 3, i == p1 ? on : (i == p2 ? mod : off));
             
             p1 = (p.config.algoX & 15);
             p2 = (getAlgoX() & 15);
-            for (u8 i = 0; i < 16; i++) set_grid_led(i, 4, i == p1 ? on : (i == p2 ? mod : off));
+            for (u8 i = 0; i < 16; i++) fb_led(i, 4, i == p1 ? on : (i == p2 ? mod : off));
             break;
         
         case PARAM_ALGOY:
             p1 = p.config.algoY >> 4;
             p2 = (getAlgoY() >> 4);
-            for (u8 i = 0; i < 8; i++) set_grid_led(i + 4, 3, i == p1 ? on : (i == p2 ? mod : off));
+            for (u8 i = 0; i < 8; i++) fb_led(i + 4, 3, i == p1 ? on : (i == p2 ? mod : off));
             
             p1 = (p.config.algoY & 15);
             p2 = (getAlgoY() & 15);
-            for (u8 i = 0; i < 16; i++) set_grid_led(i, 4, i == p1 ? on : (i == p2 ? mod : off));
+            for (u8 i = 0; i < 16; i++) fb_led(i, 4, i == p1 ? on : (i == p2 ? mod : off));
             break;
         
         case PARAM_SHIFT:
-            for (u8 x = 0; x < 13; x++) set_grid_led(x + 2, 3, x == p.config.shift ? on : (x == getShift() ? mod : off));
+            for (u8 x = 0; x < 13; x++) fb_led(x + 2, 3, x == p.config.shift ? on : (x == getShift() ? mod : off));
             break;
         
         case PARAM_SPACE:
-            for (u8 x = 0; x < 16; x++) set_grid_led(x, 3, x == p.config.space ? on : (x == getSpace() ? mod : off));
+            for (u8 x = 0; x < 16; x++) fb_led(x, 3, x == p.config.space ? on : (x == getSpace() ? mod : off));
             break;
         
         case PARAM_GATEL:
-            for (u8 x = 0; x < 16; x++) for (u8 y = 3; y < 5; y++) set_grid_led(x, y, off);
+            fb_rect(0, 3, 15, 4, off);
             
             y = y2 = 3;
             p1 = p.gate_length / 64;
             if (p1 > 16) { y = 4; p1 -= 16; }
             p2 = gate_length_mod / 64;
             if (p2 > 16) { y2 = 4; p2 -= 16; }
-            set_grid_led(p2, y2, mod);
-            set_grid_led(p1, y, on);
+            fb_led(p2, y2, mod);
+            fb_led(p1, y, on);
             break;
 
         default:
@@ -1267,17 +2289,17 @@ void process_grid_matrix(u8 x, u8 y, u8 on) {
 }
 
 void render_matrix_page() {
-    set_grid_led(0, 7, 10);
-    set_grid_led(1, 7, 10);
-    set_grid_led(0, 6, p.matrix_mode == MATRIXMODEEDIT ? 4 : 10);
+    fb_led(0, 7, 10);
+    fb_led(1, 7, 10);
+    fb_led(0, 6, p.matrix_mode == MATRIXMODEEDIT ? 4 : 10);
     
     u8 d = 12 / (MATRIXMAXSTATE + 1);
     u8 a = p.matrix_on[s.mi] ? 3 : 2;
     
-    set_grid_led(1, 3, p.m_snapshot[s.mi] == 0 ? 10 : 4);
-    set_grid_led(1, 4, p.m_snapshot[s.mi] == 1 ? 10 : 4);
-    set_grid_led(2, 3, p.m_snapshot[s.mi] == 2 ? 10 : 4);
-    set_grid_led(2, 4, p.m_snapshot[s.mi] == 3 ? 10 : 4);
+    fb_led(1, 3, p.m_snapshot[s.mi] == 0 ? 10 : 4);
+    fb_led(1, 4, p.m_snapshot[s.mi] == 1 ? 10 : 4);
+    fb_led(2, 3, p.m_snapshot[s.mi] == 2 ? 10 : 4);
+    fb_led(2, 4, p.m_snapshot[s.mi] == 3 ? 10 : 4);
     
     for (u8 x = 0; x < MATRIXOUTS; x++)
         for (u8 y = 0; y < MATRIXINS; y++) {
@@ -1286,7 +2308,7 @@ void render_matrix_page() {
             if (x < 7) _x = x + 3;
             else if (x < 9) _x = x + 4;
             else continue;
-            set_grid_led(_x, y + 1, p.matrix[s.mi][p.m_snapshot[s.mi]][y][x] * d + a);
+            fb_led(_x, y + 1, p.matrix[s.mi][p.m_snapshot[s.mi]][y][x] * d + a);
         }
 }
 
@@ -1318,28 +2340,33 @@ void process_grid_note_delay(u8 x, u8 y, u8 on) {
 void render_note_delay_page() {
     u8 off = 3;
     
-    set_grid_led(15, 2, s.run ? 15 : 4);
+    fb_led(15, 2, s.run ? 15 : 4);
     
-    for (u8 x = 4; x < 12; x++) set_grid_led(x, 2, off);
-    set_grid_led(4 + p.swing, 2, 15);
+    fb_row(2, 4, 11, off);
+    fb_led(4 + p.swing, 2, 15);
 
-    for (u8 x = 4; x < 12; x++) set_grid_led(x, 3, off);
-    set_grid_led(3 + p.delay_width, 3, 15);
+    fb_row(3, 4, 11, off);
+    fb_led(3 + p.delay_width, 3, 15);
     
-    for (u8 x = 0; x < 16; x++)
-        for (u8 y = 4; y < 8; y++)
-            set_grid_led(x, y, x == 0 || x == 8 ? 8 : off);
+    fb_rect(0, 4, 15, 7, off);
+    fb_rect(0, 4, 0, 7, 8);
+    fb_rect(8, 4, 8, 7, 8);
 
     for (u8 n = 0; n < 4; n++)
-        set_grid_led(p.note_delay[n], n + 4, 15);
+        fb_led(p.note_delay[n], n + 4, 15);
 
     for (u8 n = 4; n < 8; n++)
-        set_grid_led(p.note_delay[n] + 8, n, 15);
+        fb_led(p.note_delay[n] + 8, n, 15);
 }
 
 void process_grid_i2c(u8 x, u8 y, u8 on) {
     if (!on) return;
     
+    if (x == 14 && y == 2) {
+        toggle_i2c_follower();
+        return;
+    }
+    
     if (x == 15) {
         if (y == 2)
             toggle_i2c_device(VOICE_CV_GATE);
@@ -1372,6 +2399,16 @@ void process_grid_i2c(u8 x, u8 y, u8 on) {
         return;
     }
     
+    if (x == 2 && y == 6) {
+        set_voice_alloc(s.voice_alloc == VOICE_ALLOC_REDIRECT ? VOICE_ALLOC_DROP : VOICE_ALLOC_REDIRECT);
+        return;
+    }
+    
+    if (x == 2 && y == 7) {
+        set_voice_alloc(s.voice_alloc == VOICE_ALLOC_STEAL ? VOICE_ALLOC_DROP : VOICE_ALLOC_STEAL);
+        return;
+    }
+    
     if (y == 7) {
         if (x > 3 && x < 12) toggle_voice_on(x - 4);
         return;
@@ -1383,36 +2420,624 @@ void process_grid_i2c(u8 x, u8 y, u8 on) {
 void render_i2c_page() {
     u8 on = 15, off = 4;
 
-    set_grid_led(2, 3, p.vol_index ? off : on);
-    set_grid_led(2, 4, p.vol_index ? on : off);
+    fb_led(2, 3, p.vol_index ? off : on);
+    fb_led(2, 4, p.vol_index ? on : off);
+    
+    fb_led(2, 6, s.voice_alloc == VOICE_ALLOC_REDIRECT ? on : off);
+    fb_led(2, 7, s.voice_alloc == VOICE_ALLOC_STEAL ? on : off);
     
-    set_grid_led(0, 4, p.vol_dir == VOL_DIR_RAND ? on : off);
-    set_grid_led(0, 5, p.vol_dir == VOL_DIR_SLEW ? on : off);
-    set_grid_led(0, 6, p.vol_dir == VOL_DIR_FLIP ? on : off);
-    set_grid_led(0, 7, p.vol_dir == VOL_DIR_OFF  ? on : off);
+    fb_led(0, 4, p.vol_dir == VOL_DIR_RAND ? on : off);
+    fb_led(0, 5, p.vol_dir == VOL_DIR_SLEW ? on : off);
+    fb_led(0, 6, p.vol_dir == VOL_DIR_FLIP ? on : off);
+    fb_led(0, 7, p.vol_dir == VOL_DIR_OFF  ? on : off);
     
-    set_grid_led(15, 2, s.i2c_device[VOICE_CV_GATE] ? on : off);
-    set_grid_led(15, 3, s.i2c_device[VOICE_ER301] ? on : off);
-    set_grid_led(15, 4, s.i2c_device[VOICE_JF] ? on : off);
-    set_grid_led(15, 5, s.i2c_device[VOICE_TXO_NOTE] ? on : off);
-    set_grid_led(15, 6, s.i2c_device[VOICE_DISTING_EX] ? on : off);
-    set_grid_led(15, 7, s.i2c_device[VOICE_I2C2MIDI_1] ? on : off);
+    fb_led(14, 2, s.i2c_follower ? on : off);
+    fb_led(15, 2, s.i2c_device[VOICE_CV_GATE] ? on : off);
+    fb_led(15, 3, s.i2c_device[VOICE_ER301] ? on : off);
+    fb_led(15, 4, s.i2c_device[VOICE_JF] ? on : off);
+    fb_led(15, 5, s.i2c_device[VOICE_TXO_NOTE] ? on : off);
+    fb_led(15, 6, s.i2c_device[VOICE_DISTING_EX] ? on : off);
+    fb_led(15, 7, s.i2c_device[VOICE_I2C2MIDI_1] ? on : off);
     
     for (u8 i = 0; i < 8; i++) {
-        for (u8 y = 0; y < p.voice_vol[i][p.vol_index]; y++)
-            set_grid_led(i + 4, 6 - y, p.voice_on[i] ? 4 : 2);
+        if (p.voice_vol[i][p.vol_index])
+            fb_rect(i + 4, 7 - p.voice_vol[i][p.vol_index], i + 4, 6, p.voice_on[i] ? 4 : 2);
+        
+        fb_led(i + 4, 7 - p.voice_vol[i][p.vol_index], p.voice_on[i] ? 15 : 6);
+        fb_led(i + 4, 7, p.voice_on[i] ? 6 : 15);
+    }
+}
+
+void render_arc() {
+    // each ring shows its value as a filled arc. only the segment between the
+    // previously shown value and the new one is redrawn
+    
+    if (!is_arc_connected()) {
+        is_arc_shown = 0;
+        return;
+    }
+    
+    if (!is_arc_shown) {
+        clear_all_arc_leds();
+        for (u8 e = 0; e < ARCENCODERS; e++) arc_shown[e] = 0;
+        is_arc_shown = 1;
+    }
+    
+    u8 count = get_arc_encoder_count();
+    if (count > ARCENCODERS) count = ARCENCODERS;
+    
+    for (u8 e = 0; e < count; e++) {
+        u8 pos = arc_position(e);
+        if (pos > ARCLEDS) pos = ARCLEDS;
+        
+        for (u8 led = min(pos, arc_shown[e]); led < max(pos, arc_shown[e]); led++)
+            set_arc_led(e, led, led < pos ? 10 : 0);
+        arc_shown[e] = pos;
+    }
+}
+
+
+// ----------------------------------------------------------------------------
+// grid framebuffer
+//
+// pages render into a packed 4 bit framebuffer, which is then pushed to the
+// grid in one pass that only updates the LEDs that changed since last frame
+
+void fb_led(u8 x, u8 y, u8 level) {
+    if (x >= GRIDCOLS || y >= GRIDROWS) return;
+    
+    u8 shift = (x & 1) << 2;
+    u8 *b = &grid_fb[y][x >> 1];
+    *b = (*b & ~(15 << shift)) | ((level & 15) << shift);
+}
+
+void fb_row(u8 y, u8 x1, u8 x2, u8 level) {
+    if (y >= GRIDROWS) return;
+    if (x2 >= GRIDCOLS) x2 = GRIDCOLS - 1;
+    
+    level &= 15;
+    for (u8 x = x1; x <= x2; x++) {
+        if (!(x & 1) && x < x2)
+            grid_fb[y][x++ >> 1] = level | (level << 4);
+        else
+            fb_led(x, y, level);
+    }
+}
+
+void fb_rect(u8 x1, u8 y1, u8 x2, u8 y2, u8 level) {
+    for (u8 y = y1; y <= y2 && y < GRIDROWS; y++) fb_row(y, x1, x2, level);
+}
+
+void blit_grid() {
+    for (u8 y = 0; y < GRIDROWS; y++)
+        for (u8 x = 0; x < GRIDCOLS / 2; x++) {
+            u8 b = grid_fb[y][x];
+            if (is_grid_shown && b == grid_shown[y][x]) continue;
+            
+            grid_shown[y][x] = b;
+            set_grid_led(x << 1, y, b & 15);
+            set_grid_led((x << 1) + 1, y, b >> 4);
+        }
+    is_grid_shown = 1;
+}
+
+
+// ----------------------------------------------------------------------------
+// event queue
+//
+// multipass already moves events out of interrupts through its own queue, so
+// both ends of this one run in the main loop. it defers and merges events
+// until the next clock has been handled
+
+u8 is_queued_event(u8 event, u8 *data, u8 length) {
+    if (length > QUEUEDATALEN) return 0;
+    
+    switch (event) {
+        case GRID_KEY_PRESSED:
+        case GRID_KEY_HELD:
+        case ARC_ENCODER_COARSE:
+        case FRONT_BUTTON_PRESSED:
+        case FRONT_BUTTON_HELD:
+        case BUTTON_PRESSED:
+            return 1;
+        case TIMED_EVENT:
+            // speed ticks are only worth queueing to merge them into a burst
+            return (data[0] == SPEEDTIMER || data[0] == SPEEDBUTTONTIMER) && queue_head != queue_tail;
+        default:
+            return 0;
+    }
+}
+
+u8 queue_event(u8 event, u8 *data, u8 length) {
+    // a speed tick right after the same tick is merged into it, since each
+    // one only reads the current state. arc ticks of the same encoder are
+    // added to the last one, key and button events are edges and are always
+    // queued. if the queue is full it's drained first and 0 is returned, so
+    // the event is handled right after the ones queued before it
+    
+    s16 delta = event == ARC_ENCODER_COARSE ? (data[1] ? 1 : -1) : 0;
+    
+    if (queue_head != queue_tail) {
+        u8 last = (queue_head + QUEUELEN - 1) % QUEUELEN;
+        if (queue_events[last] == event && event == TIMED_EVENT && queue_data[last][0] == data[0]) {
+            queue_merged++;
+            return 1;
+        }
+        if (queue_events[last] == event && event == ARC_ENCODER_COARSE && queue_data[last][0] == data[0]) {
+            queue_deltas[last] += delta;
+            queue_merged++;
+            return 1;
+        }
+    }
+    
+    u8 next = (queue_head + 1) % QUEUELEN;
+    if (next == queue_tail) {
+        drain_events();
+        return 0;
+    }
+    
+    queue_events[queue_head] = event;
+    queue_lengths[queue_head] = length;
+    queue_deltas[queue_head] = delta;
+    memcpy(queue_data[queue_head], data, length);
+    queue_head = next;
+    
+    u8 depth = (queue_head + QUEUELEN - queue_tail) % QUEUELEN;
+    if (depth > queue_depth_max) queue_depth_max = depth;
+    
+    if (!is_queue_pending) {
+        is_queue_pending = 1;
+        add_timed_event(QUEUETIMER, 1, 0);
+    }
+    return 1;
+}
+
+void drain_events() {
+    while (queue_tail != queue_head) {
+        u8 i = queue_tail;
+        if (queue_events[i] == ARC_ENCODER_COARSE)
+            process_arc(queue_data[i][0], queue_deltas[i]);
+        else
+            handle_event(queue_events[i], queue_data[i], queue_lengths[i]);
+        queue_tail = (i + 1) % QUEUELEN;
+    }
+    
+    // the queue is printed whenever it gets deeper than it has been, but
+    // not in the middle of a bank export
+    if (queue_depth_max > queue_depth_shown && !is_bank_exporting) {
+        queue_depth_shown = queue_depth_max;
+        print_int("queue depth", queue_depth_max);
+        print_int("queue merged", queue_merged);
+    }
+}
+
+
+// ----------------------------------------------------------------------------
+// midi
+//
+// CCs work with the pinned multipass. clock sync doesn't: multipass only
+// forwards MIDI_CONNECTED, MIDI_NOTE, MIDI_CC and MIDI_AFTERTOUCH, so there
+// are no MIDI_CLOCK, MIDI_START or MIDI_STOP events to handle. the sync code
+// below is kept behind MIDI_SYNC, which no release build defines, until
+// multipass forwards realtime messages. then MIDI_SYNC can be added to the
+// CFLAGS of the multipass app Makefiles
+
+void process_midi_cc(u8 cc, u8 value) {
+    // controllers can send CCs much faster than the clock, so they are only
+    // stored here and picked up by update_matrix on the next step
+    
+    // a CC only counts as a matrix source while it's above 0, so a
+    // controller turned all the way down stops weighing on the average
+    
+    if (cc < MIDICCFIRST || cc >= MIDICCFIRST + MIDICCCOUNT) return;
+    cc -= MIDICCFIRST;
+    midi_cc[cc] = value;
+    if (value) midi_cc_on |= 1 << cc; else midi_cc_on &= ~(1 << cc);
+}
+
+#ifdef MIDI_SYNC
+void midi_clock() {
+    // MIDI clock keeps running while the transport is stopped, and the
+    // internal clock stays off for as long as ticks keep arriving
+    
+    u32 now = get_time();
+    midi_tick_last = now;
+    is_midi_ticking = 1;
+    
+    if (!is_midi_running || ++midi_ticks < MIDICLOCKDIVIDER) return;
+    midi_ticks = 0;
+    
+    u32 interval = now - midi_step_last;
+    midi_step_last = now;
+    midi_clock_period = interval > EXTCLOCKTIMEOUT ? 0 : interval * 1000;
+    
+    if (s.run) step();
+}
+
+void midi_start() {
+    // the first clock after start is the first step
+    reset();
+    is_midi_running = 1;
+    midi_ticks = MIDICLOCKDIVIDER - 1;
+    midi_clock_period = 0;
+    midi_step_last = get_time();
+}
+
+void midi_stop() {
+    is_midi_running = 0;
+    for (u8 i = 0; i < NOTECOUNT; i++) stop_note(i);
+}
+
+u8 is_midi_clocked() {
+    if (is_midi_ticking && get_time() - midi_tick_last > EXTCLOCKTIMEOUT) is_midi_ticking = 0;
+    return is_midi_ticking;
+}
+#endif
+
+
+// ----------------------------------------------------------------------------
+// random numbers
+//
+// xorshift32 streams, one per voice so random volumes of one voice don't
+// depend on how many notes other voices played. all streams are derived from
+// the preset seed, so a session is reproducible from the same preset
+
+void seed_random(u32 seed) {
+    for (u8 i = 0; i < RANDSTREAMS; i++) {
+        u32 x = seed + (i + 1) * 0x9E3779B9;
+        x = (x ^ (x >> 16)) * 0x85EBCA6B;
+        x = (x ^ (x >> 13)) * 0xC2B2AE35;
+        x ^= x >> 16;
+        rand_state[i] = x ? x : 1;
+    }
+}
+
+u32 next_random(u8 stream) {
+    u32 x = rand_state[stream];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return rand_state[stream] = x;
+}
+
+u32 random_range(u8 stream, u32 range) {
+    // maps to 0..range-1 with a multiply instead of a division
+    return ((u64)next_random(stream) * range) >> 32;
+}
+
+
+// ----------------------------------------------------------------------------
+// preset bank
+//
+// exports print the bank as hex lines between "bank" and "end", one record
+// right after each step like saves. imports are fed a few bytes at a time,
+// and each preset is saved like any other once its CRC checks out, so
+// neither ever holds more than one preset in RAM besides the one being
+// saved. if the next preset is complete before the last one is written, the
+// last one is finished right away, which can delay a clock tick. the shared
+// data is applied once the last preset is written
+
+void export_bank() {
+    bank_state = BANK_IDLE;
+    is_bank_exporting = 1;
+    export_record = 0;
+    add_timed_event(BANKTIMER, step_period_us() / 1000 + SAVEIDLECYCLE, 0);
+}
+
+void continue_export() {
+    if (!is_bank_exporting) return;
+    
+    bank_crc = 0xFFFFFFFF;
+    bank_line_len = 0;
+    
+    if (export_record == 0) {
+        u16 shared_len = bank_record_len(shared_fields, SHAREDFIELDCOUNT);
+        u16 preset_len = bank_record_len(preset_fields, PRESETFIELDCOUNT);
         
-        set_grid_led(i + 4, 7 - p.voice_vol[i][p.vol_index], p.voice_on[i] ? 15 : 6);
-        set_grid_led(i + 4, 7, p.voice_on[i] ? 6 : 15);
+        print_debug("bank");
+        for (u8 i = 0; i < 4; i++) put_bank_byte(BANK_MAGIC[i]);
+        put_bank_byte(BANK_VERSION);
+        put_bank_byte(get_preset_count());
+        put_bank_byte(shared_len);
+        put_bank_byte(shared_len >> 8);
+        put_bank_byte(preset_len);
+        put_bank_byte(preset_len >> 8);
+        put_bank_record(shared_fields, SHAREDFIELDCOUNT, (u8 *)&s);
+    } else {
+        read_preset(export_record - 1, &bank_p);
+        put_bank_record(preset_fields, PRESETFIELDCOUNT, (u8 *)&bank_p);
+    }
+    
+    put_bank_crc();
+    flush_bank_line();
+    
+    if (++export_record > get_preset_count()) {
+        is_bank_exporting = 0;
+        print_debug("end");
+        return;
     }
+    
+    add_timed_event(BANKTIMER, step_period_us() / 1000 + SAVEIDLECYCLE, 0);
 }
 
-void render_arc() { }
+void put_bank_record(const bank_field_t *fields, u8 count, u8 *base) {
+    for (u8 f = 0; f < count; f++) {
+        for (u16 e = 0; e < fields[f].count; e++) {
+            u8 *v = base + fields[f].offset + e * fields[f].size;
+            u32 value = fields[f].size == 1 ? *v : fields[f].size == 2 ? *(u16 *)v : *(u32 *)v;
+            for (u8 b = 0; b < fields[f].size; b++) put_bank_byte(value >> (b * 8));
+        }
+    }
+}
+
+void put_bank_byte(u8 byte) {
+    bank_crc = crc32(bank_crc, byte);
+    bank_line[bank_line_len++] = byte;
+    if (bank_line_len == BANKLINELEN) flush_bank_line();
+}
+
+void put_bank_crc() {
+    u32 crc = ~bank_crc;
+    for (u8 b = 0; b < 4; b++) {
+        bank_line[bank_line_len++] = crc >> (b * 8);
+        if (bank_line_len == BANKLINELEN) flush_bank_line();
+    }
+}
+
+void flush_bank_line() {
+    if (bank_line_len) print_hex_bytes(bank_line, bank_line_len);
+    bank_line_len = 0;
+}
+
+void import_bank() {
+    is_bank_exporting = 0;
+    is_bank_imported = 0;
+    
+    bank_state = BANK_HEADER;
+    bank_pos = 0;
+    bank_crc = 0xFFFFFFFF;
+}
+
+void import_bank_byte(u8 byte) {
+    const bank_field_t *field;
+    u8 *v;
+    
+    switch (bank_state) {
+        case BANK_HEADER:
+            bank_crc = crc32(bank_crc, byte);
+            bank_header[bank_pos++] = byte;
+            if (bank_pos < BANK_HEADER_LEN) return;
+            
+            if (memcmp(bank_header, BANK_MAGIC, 4) || bank_header[4] != BANK_VERSION ||
+                (bank_header[6] | (bank_header[7] << 8)) != bank_record_len(shared_fields, SHAREDFIELDCOUNT) ||
+                (bank_header[8] | (bank_header[9] << 8)) != bank_record_len(preset_fields, PRESETFIELDCOUNT)) {
+                bank_state = BANK_ERROR;
+                return;
+            }
+            
+            bank_record = 0;
+            start_bank_record();
+            return;
+            
+        case BANK_RECORD:
+            bank_crc = crc32(bank_crc, byte);
+            field = (bank_record ? preset_fields : shared_fields) + bank_field;
+            bank_value |= (u32)byte << (bank_byte * 8);
+            if (++bank_byte < field->size) return;
+            
+            v = (bank_record ? (u8 *)&bank_p : (u8 *)&bank_s) + field->offset + bank_element * field->size;
+            if (field->size == 1) *v = bank_value;
+            else if (field->size == 2) *(u16 *)v = bank_value;
+            else *(u32 *)v = bank_value;
+            
+            bank_byte = 0;
+            bank_value = 0;
+            if (++bank_element < field->count) return;
+            
+            bank_element = 0;
+            if (++bank_field < (bank_record ? PRESETFIELDCOUNT : SHAREDFIELDCOUNT)) return;
+            
+            bank_state = BANK_CRC;
+            bank_pos = 0;
+            return;
+            
+        case BANK_CRC:
+            bank_value |= (u32)byte << (bank_pos * 8);
+            if (++bank_pos < 4) return;
+            
+            if (bank_value != ~bank_crc) {
+                bank_state = BANK_ERROR;
+                return;
+            }
+            
+            commit_bank_record();
+            if (++bank_record > bank_header[5]) {
+                bank_state = BANK_IDLE;
+                return;
+            }
+            
+            bank_crc = 0xFFFFFFFF;
+            start_bank_record();
+            return;
+            
+        default:
+            return;
+    }
+}
+
+void start_bank_record() {
+    bank_state = BANK_RECORD;
+    bank_field = bank_element = bank_byte = 0;
+    bank_value = 0;
+}
+
+void commit_bank_record() {
+    if (bank_record && bank_record <= get_preset_count()) {
+        start_save(bank_record - 1, &bank_p);
+        is_bank_saving = 1;
+    }
+    
+    if (bank_record == bank_header[5]) {
+        is_bank_imported = 1;
+        if (!save_phase) add_timed_event(SAVETIMER, 1, 0);
+    }
+}
+
+void apply_bank_shared() {
+    // slots that were saved here but aren't in the bank stay saved
+    memcpy(bank_s.saved_presets, s.saved_presets, sizeof(s.saved_presets));
+    bank_s.i2c_follower = s.i2c_follower;
+    bank_s.version = s.version;
+    is_bank_imported = 0;
+    
+    s = bank_s;
+    store_shared_data_to_flash(&s);
+    set_up_i2c();
+    load_preset(selected_preset);
+}
+
+u16 bank_record_len(const bank_field_t *fields, u8 count) {
+    u16 len = 0;
+    for (u8 f = 0; f < count; f++) len += fields[f].size * fields[f].count;
+    return len;
+}
+
+u32 crc32(u32 crc, u8 byte) {
+    crc ^= byte;
+    for (u8 b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    return crc;
+}
+
+
+// ----------------------------------------------------------------------------
+// event trace
+
+u32 get_time() {
+#ifdef EVENT_TRACE
+    if (is_replaying) return replay_time;
+#endif
+    return get_global_time();
+}
+
+u8 read_knob_count() {
+#ifdef EVENT_TRACE
+    if (is_replaying) return replay_header->knob_count;
+#endif
+    return get_knob_count();
+}
+
+u16 read_knob() {
+    // knob reads come back in the order they were recorded in
+#ifdef EVENT_TRACE
+    if (is_replaying) {
+        while (replay_knob_next < replay_count && replay_entries[replay_knob_next].event != TRACE_KNOB_READ)
+            replay_knob_next++;
+        if (replay_knob_next == replay_count) return knob_value;
+        trace_entry_t *e = &replay_entries[replay_knob_next++];
+        return e->data[0] | (e->data[1] << 8);
+    }
+#endif
+    u16 value = get_knob_value(0);
+#ifdef EVENT_TRACE
+    u8 data[2] = { value, value >> 8 };
+    record_event(TRACE_KNOB_READ, data, 2);
+#endif
+    return value;
+}
+
+#ifdef EVENT_TRACE
+void start_trace() {
+    trace_head = trace_tail = trace_dropped = 0;
+    trace_time = get_time();
+    
+    trace_header.seed = p.seed ^ trace_time;
+    trace_header.preset = selected_preset;
+    trace_header.knob_count = get_knob_count();
+    trace_header.knob = knob_value;
+    seed_random(trace_header.seed);
+    
+    u8 line[TRACEHEADERLEN];
+    put_trace_value(line, 0, trace_header.seed, 4);
+    put_trace_value(line, 4, trace_header.preset, 1);
+    put_trace_value(line, 5, trace_header.knob_count, 1);
+    put_trace_value(line, 6, trace_header.knob, 2);
+    
+    print_debug("trace");
+    print_hex_bytes(line, TRACEHEADERLEN);
+    add_timed_event(TRACETIMER, TRACEDUMPCYCLE, 1);
+}
+
+void record_event(u8 event, u8 *data, u8 length) {
+    if (is_replaying) return;
+    if (event == TIMED_EVENT && data[0] == TRACETIMER) return;
+    
+    u16 next = (trace_head + 1) % TRACELEN;
+    if (next == trace_tail) {
+        trace_dropped++;
+        return;
+    }
+    
+    u32 time = get_time();
+    u32 delta = time - trace_time;
+    trace_time = time;
+    
+    trace_entry_t *e = &trace[trace_head];
+    e->delta = delta > 0xFFFF ? 0xFFFF : delta;
+    e->event = event;
+    e->length = length;
+    for (u8 i = 0; i < TRACEDATALEN; i++) e->data[i] = i < length ? data[i] : 0;
+    
+    trace_head = next;
+}
+
+void dump_trace() {
+    // entries wait for a bank export to finish, so its lines aren't mixed
+    // with others
+    if (is_bank_exporting) return;
+    
+    if (trace_dropped) {
+        print_int("trace dropped", trace_dropped);
+        trace_dropped = 0;
+    }
+    
+    u8 line[TRACEENTRYLEN];
+    while (trace_tail != trace_head) {
+        trace_entry_t *e = &trace[trace_tail];
+        put_trace_value(line, 0, e->delta, 2);
+        put_trace_value(line, 2, e->event, 1);
+        put_trace_value(line, 3, e->length, 1);
+        for (u8 i = 0; i < TRACEDATALEN; i++) line[4 + i] = e->data[i];
+        print_hex_bytes(line, TRACEENTRYLEN);
+        trace_tail = (trace_tail + 1) % TRACELEN;
+    }
+}
+
+void put_trace_value(u8 *bytes, u8 offset, u32 value, u8 size) {
+    // puts a value little endian, the same on the module and on a host
+    for (u8 b = 0; b < size; b++) bytes[offset + b] = value >> (b * 8);
+}
+
+#endif
 
 
 // ----------------------------------------------------------------------------
 // helper functions
 
+void print_hex_bytes(u8 *bytes, u8 length) {
+    // raw bytes as one hex line, so the host side can rebuild binary data
+    // from the debug output without any parsing
+    
+    static const char hex[] = "0123456789abcdef";
+    char line[length * 2 + 1];
+    
+    for (u8 i = 0; i < length; i++) {
+        line[i * 2] = hex[bytes[i] >> 4];
+        line[i * 2 + 1] = hex[bytes[i] & 15];
+    }
+    line[length * 2] = 0;
+    print_debug(line);
+}
+
 // http://www.jb.man.ac.uk/~slowe/cpp/itoa.html
 // http://embeddedgurus.com/stack-overflow/2009/06/division-of-integers-by-constants/
 // http://codereview.blogspot.com/2009/06/division-of-integers-by-constants.html
@@ -1468,14 +3093,14 @@ char* itoa(int value, char* result, int base) {
 - octave up/down buttons
 - jf mode should be reset when choosing another i2c device
 - minimal gate lenght reduced
+- delays and gate length follow ext clock
+- MIDI CCs as matrix sources, MIDI clock sync (needs MIDI_SYNC build)
 
 -- soon
 
 - parameter sequencer
 - copy between matrix and volume snapshots
 - undo matrix random/clear
-- delays are not calculated properly for ext clock
-- make gate len proportional to ext clock
 - improve teletype display
 
 -- not tested:
@@ -8,6 +8,7 @@
 // ----------------------------------------------------------------------------
 
 #pragma once
+#include "stddef.h"
 #include "types.h"
 #include "constants.h"
 #include "engine.h"
@@ -20,6 +21,11 @@
 #define MATRIXCOUNT 2
 #define MATRIXSNAPSHOTS 4
 #define TRANSSEQLEN 8
+#define MAXPRESETCOUNT 64
+
+// stored with the shared data. change it whenever shared_data_t or
+// preset_data_t change, and bring older data up to date in migrate_flash
+#define FLASHVERSION 0x48520001
 
 
 // ----------------------------------------------------------------------------
@@ -31,6 +37,10 @@ typedef struct {
     u8 mi;
     u8 i2c_device[MAX_DEVICE_COUNT];
     u8 run;
+    u8 voice_alloc;
+    u8 i2c_follower;
+    u8 saved_presets[MAXPRESETCOUNT / 8];
+    u32 version;
 } shared_data_t;
 
 typedef struct {
@@ -62,9 +72,221 @@ typedef struct {
     u8 vol_dir;
     u8 voice_vol[NOTECOUNT][2];
     u8 voice_on[NOTECOUNT];
+    
+    u32 seed;
 } preset_data_t;
 
 
+// ----------------------------------------------------------------------------
+// flash layout
+//
+// multipass keeps the shared data and then every preset in one struct in
+// flash, mirrored by flash_layout_t (preset_meta_t is empty). growing either
+// struct moves every preset, so flash from before FLASHVERSION is read in
+// the layout of flash_layout_v0_t and converted by migrate_flash
+
+typedef struct {
+    u8 page;
+    u8 param;
+    u8 mi;
+    u8 i2c_device[MAX_DEVICE_COUNT];
+    u8 run;
+} shared_data_v0_t;
+
+typedef struct {
+    engine_config_t config;
+    
+    u16 speed;
+    u16 gate_length;
+    
+    u8 swing;
+    u8 delay_width;
+    u8 note_delay[NOTECOUNT];
+    
+    s8 transpose[TRANSSEQLEN];
+    u8 transpose_seq_on;
+
+    u8 scale_buttons[SCALECOUNT][SCALELEN];
+    u8 current_scale;
+    s8 octave;
+
+    u8 matrix[MATRIXCOUNT][MATRIXSNAPSHOTS][MATRIXINS][MATRIXOUTS];
+    u8 matrix_on[MATRIXCOUNT];
+    u8 m_snapshot[MATRIXCOUNT];
+    u8 matrix_mode;
+    
+    u8 vol_index;
+    u8 vol_dir;
+    u8 voice_vol[NOTECOUNT][2];
+    u8 voice_on[NOTECOUNT];
+} preset_data_v0_t;
+
+typedef struct {
+    u8 fresh;
+    u8 preset_index;
+    shared_data_t shared;
+    preset_data_t presets[1];
+} flash_layout_t;
+
+typedef struct {
+    u8 fresh;
+    u8 preset_index;
+    shared_data_v0_t shared;
+    preset_data_v0_t presets[1];
+} flash_layout_v0_t;
+
+#ifdef EVENT_TRACE
+
+#define TRACELEN 256
+#define TRACEDATALEN 4
+
+// the trace is printed as a "trace" line, the header, then an entry per
+// line, each as hex. every field is little endian, in this order:
+//
+// header: seed (4 bytes), preset, knob count, knob value (2 bytes)
+// entry: delta (2 bytes), event, length, data
+//
+// each knob reading is an entry of its own, TRACE_KNOB_READ with the value
+// in the first 2 data bytes, right after the event it was read for
+
+#define TRACEHEADERLEN 8
+#define TRACEENTRYLEN (4 + TRACEDATALEN)
+#define TRACE_KNOB_READ 0xFF
+
+typedef struct {
+    u32 seed;
+    u8 preset;
+    u8 knob_count;
+    u16 knob;
+} trace_header_t;
+
+typedef struct {
+    u16 delta;
+    u8 event;
+    u8 length;
+    u8 data[TRACEDATALEN];
+} trace_entry_t;
+
+#endif
+
+
+// ----------------------------------------------------------------------------
+// i2c follower protocol
+//
+// the first byte is the command. set commands are followed by the value,
+// get commands by the voice or mod index, and the leader then reads the
+// response. gate length is sent as 2 bytes, high byte first
+//
+// set, reset and bank commands arrive as I2C_RECEIVED events and always work.
+// get commands need multipass to call get_i2c_response() when the leader
+// reads, which the pinned multipass doesn't do, so they are only built with
+// I2C_FOLLOWER_READ defined
+
+#define I2C_FOLLOWER_ADDRESS 0x4A
+
+#define I2C_SET_LENGTH      0x01
+#define I2C_SET_ALGOX       0x02
+#define I2C_SET_ALGOY       0x03
+#define I2C_SET_SHIFT       0x04
+#define I2C_SET_SPACE       0x05
+#define I2C_SET_GATE_LENGTH 0x06
+#define I2C_RESET           0x07
+
+#define I2C_GET_NOTE        0x10
+#define I2C_GET_GATE        0x11
+#define I2C_GET_MOD_CV      0x12
+#define I2C_GET_MOD_GATE    0x13
+#define I2C_GET_STEP        0x14
+#define I2C_GET_STATE       0x15
+
+#define I2C_BANK_EXPORT     0x20
+#define I2C_BANK_IMPORT     0x21
+#define I2C_BANK_DATA       0x22
+
+// layout of the I2C_GET_STATE response
+#define I2C_STATE_NOTES     0
+#define I2C_STATE_GATES     (I2C_STATE_NOTES + NOTECOUNT)
+#define I2C_STATE_MOD_CVS   (I2C_STATE_GATES + NOTECOUNT)
+#define I2C_STATE_MOD_GATES (I2C_STATE_MOD_CVS + MODCOUNT)
+#define I2C_STATE_STEP      (I2C_STATE_MOD_GATES + MODCOUNT)
+#define I2C_STATE_LEN       (I2C_STATE_STEP + 1)
+
+#ifdef I2C_FOLLOWER_READ
+u8 get_i2c_response(u8 *request, u8 length, u8 *response);
+#endif
+
+
+// ----------------------------------------------------------------------------
+// preset bank format
+//
+// a bank is a header, the shared data and then every preset. shared data and
+// presets are records of the fields below in this order, each value little
+// endian, followed by the CRC32 of the record (the first one also covers the
+// header). the encoding doesn't depend on how a compiler lays out the
+// structs, so a bank can move between modules and to the host tool
+//
+// header: magic, version, preset count, shared record length, preset record
+// length (both 16 bit)
+//
+// for now a bank is exported through the debug output and imported over
+// i2c. an export is a "bank" line, the bank as hex lines of up to 32 bytes
+// with a record ending its line, and an "end" line. nothing else is printed
+// until the export is done. lines can be separated by CR, LF or both
+
+#define BANK_MAGIC "HRTB"
+#define BANK_VERSION 1
+#define BANK_HEADER_LEN 10
+
+typedef struct {
+    const char *name;
+    u16 offset;
+    u8 size;
+    u8 is_signed;
+    u16 count;
+} bank_field_t;
+
+#define BANK_FIELD(type, field, size, is_signed) \
+    { #field, offsetof(type, field), size, is_signed, sizeof(((type *)0)->field) / size }
+
+#define SHARED_BANK_FIELDS { \
+    BANK_FIELD(shared_data_t, page, 1, 0), \
+    BANK_FIELD(shared_data_t, param, 1, 0), \
+    BANK_FIELD(shared_data_t, mi, 1, 0), \
+    BANK_FIELD(shared_data_t, i2c_device, 1, 0), \
+    BANK_FIELD(shared_data_t, run, 1, 0), \
+    BANK_FIELD(shared_data_t, voice_alloc, 1, 0), \
+    BANK_FIELD(shared_data_t, i2c_follower, 1, 0), \
+    BANK_FIELD(shared_data_t, saved_presets, 1, 0) \
+}
+
+#define PRESET_BANK_FIELDS { \
+    BANK_FIELD(preset_data_t, config.length, 1, 0), \
+    BANK_FIELD(preset_data_t, config.algoX, 1, 0), \
+    BANK_FIELD(preset_data_t, config.algoY, 1, 0), \
+    BANK_FIELD(preset_data_t, config.shift, 1, 0), \
+    BANK_FIELD(preset_data_t, config.space, 1, 0), \
+    BANK_FIELD(preset_data_t, speed, 2, 0), \
+    BANK_FIELD(preset_data_t, gate_length, 2, 0), \
+    BANK_FIELD(preset_data_t, swing, 1, 0), \
+    BANK_FIELD(preset_data_t, delay_width, 1, 0), \
+    BANK_FIELD(preset_data_t, note_delay, 1, 0), \
+    BANK_FIELD(preset_data_t, transpose, 1, 1), \
+    BANK_FIELD(preset_data_t, transpose_seq_on, 1, 0), \
+    BANK_FIELD(preset_data_t, scale_buttons, 1, 0), \
+    BANK_FIELD(preset_data_t, current_scale, 1, 0), \
+    BANK_FIELD(preset_data_t, octave, 1, 1), \
+    BANK_FIELD(preset_data_t, matrix, 1, 0), \
+    BANK_FIELD(preset_data_t, matrix_on, 1, 0), \
+    BANK_FIELD(preset_data_t, m_snapshot, 1, 0), \
+    BANK_FIELD(preset_data_t, matrix_mode, 1, 0), \
+    BANK_FIELD(preset_data_t, vol_index, 1, 0), \
+    BANK_FIELD(preset_data_t, vol_dir, 1, 0), \
+    BANK_FIELD(preset_data_t, voice_vol, 1, 0), \
+    BANK_FIELD(preset_data_t, voice_on, 1, 0), \
+    BANK_FIELD(preset_data_t, seed, 4, 0) \
+}
+
+
 // ----------------------------------------------------------------------------
 // firmware settings/variables main.c needs to know
 
@@ -78,6 +300,10 @@ void process_event(u8 event, u8 *data, u8 length);
 void render_grid(void);
 void render_arc(void);
 
+#ifdef EVENT_TRACE
+void replay_trace(trace_header_t *header, trace_entry_t *entries, u16 count);
+#endif
+
 
 // ----------------------------------------------------------------------------
 // functions engine needs to call
@@ -43,16 +43,27 @@ uint16_t weights[TRACKCOUNT] = {1, 2, 4, 7, 5, 3, 4, 2};
 
 engine_t engine;
 
+typedef uint16_t (*noteKernel_t)(int n);
+typedef uint8_t (*gateKernel_t)(int n);
+
+static noteKernel_t noteKernel;
+static gateKernel_t gateKernel;
+
 static void updateCounters(void);
 static void updateTrackParameters(void);
 static void updateTrackValues(void);
+static void updateFlippedTracks(void);
+static void updateSpaceMasks(void);
 static void calculateNotes(void);
 static void calculateMods(void);
 static void calculateNote(int n);
 static void calculateNextNote(int n);
+static void selectKernels(void);
 static void initHistory(void);
 static void pushHistory(void);
 
+#define TRACKON(i) ((engine.trackOn >> (i)) & 1)
+
 
 // ----------------------------------------------------------------------------
 // functions for control
@@ -63,6 +74,8 @@ void initEngine(engine_config_t *config) {
     updateAlgoY(config->algoY);
     updateShift(config->shift);
     updateSpace(config->space);
+    updateSpaceMasks();
+    selectKernels();
     
     reset();
     updateTrackParameters();
@@ -70,6 +83,7 @@ void initEngine(engine_config_t *config) {
     initHistory();
     calculateNotes();
     calculateMods();
+    engine.changed = 0;
 }
 
 void updateScales(uint8_t scales[SCALECOUNT][SCALELEN]) {
@@ -80,7 +94,16 @@ void updateScales(uint8_t scales[SCALECOUNT][SCALELEN]) {
                 engine.scales[s][engine.scaleCount[s]++] = i;
             }
         }
+        
+        // note sums are at most 28 (all weights) + 16 (3 neighbours) + 19
+        // (shift), so the whole range maps to a final pitch with one lookup
+        for (uint8_t n = 0; n < NOTESUMCOUNT; n++) {
+            uint8_t octave = (n / 12 < 2 ? n / 12 : 2) * 12;
+            engine.pitches[s][n] = engine.scaleCount[s] ? engine.scales[s][n % engine.scaleCount[s]] + octave : 0;
+        }
     }
+    
+    engine.changed = 0xFF;
 }
 
 uint8_t getLength() {
@@ -108,11 +131,17 @@ void updateLength(uint8_t length) {
 }
 
 void updateAlgoX(uint8_t algoX) {
+    if (algoX == engine.config.algoX) return;
     engine.config.algoX = algoX;
+    updateTrackParameters();
+    engine.tracksDirty = 1;
 }
 
 void updateAlgoY(uint8_t algoY) {
+    if (algoY == engine.config.algoY) return;
     engine.config.algoY = algoY;
+    selectKernels();
+    engine.changed = 0xFF;
 }
 
 void updateShift(uint8_t shift) {
@@ -124,21 +153,52 @@ void updateShift(uint8_t shift) {
 }
 
 void updateSpace(uint8_t space) {
+    if (space == engine.config.space) return;
     engine.config.space = space;
+    updateSpaceMasks();
 }
 
 void clock() {
     updateCounters();
-    updateTrackParameters();
-    updateTrackValues();
+    if (engine.tracksDirty) updateTrackValues(); else updateFlippedTracks();
     pushHistory();
     calculateNotes();
     calculateMods();
+    engine.changed = 0;
+}
+
+// recalculates the current step in place, for a reset or scale change that
+// arrives between clocks. gates are compared to the previous step again, so
+// history and change lists end up as if the step had been calculated this
+// way. returns the voices whose current note or gate changed
+uint8_t recalculate() {
+    uint32_t gates = engine.gateOn[0];
+    uint8_t notes[NOTECOUNT];
+    
+    for (uint8_t n = 0; n < NOTECOUNT; n++) {
+        notes[n] = engine.notes[n][0];
+        engine.notes[n][0] = engine.notes[n][1];
+    }
+    engine.gateOn[0] = engine.gateOn[1];
+    engine.changeCount[engine.changeHead] = 0;
+    
+    if (engine.tracksDirty) updateTrackValues();
+    engine.changed = 0xFF;
+    calculateNotes();
+    calculateMods();
+    engine.changed = 0;
+    
+    uint8_t changedVoices = 0;
+    for (uint8_t n = 0; n < NOTECOUNT; n++)
+        if (notes[n] != engine.notes[n][0] || ((gates ^ engine.gateOn[0]) & ((uint32_t)0x01010101 << n)))
+            changedVoices |= 1 << n;
+    return changedVoices;
 }
 
 void reset() {
     engine.globalCounter = engine.spaceCounter = 0;
     for (uint8_t i = 0; i < TRACKCOUNT; i++) engine.counter[i] = 0;
+    engine.tracksDirty = 1;
 }
 
 uint8_t isReset() {
@@ -151,6 +211,7 @@ uint8_t getCurrentStep() {
 
 void setCurrentScale(uint8_t scale) {
     if (scale >= SCALECOUNT) return;
+    if (scale != engine.scale) engine.changed = 0xFF;
     engine.scale = scale;
 }
 
@@ -167,11 +228,20 @@ uint8_t getNote(uint8_t index, u8 generation) {
 }
 
 uint8_t getGate(uint8_t index, u8 generation) {
-    return engine.gateOn[index][generation];
+    uint32_t planes = engine.gateOn[generation] >> index;
+    return (planes & 1) | ((planes >> 7) & 2) | ((planes >> 14) & 4) | ((planes >> 21) & 8);
 }
 
 uint8_t getGateChanged(uint8_t index, u8 generation) {
-    return engine.gateChanged[index][generation];
+    return (engine.gateChanged[generation] >> index) & 1;
+}
+
+uint8_t getChangeCount(u8 generation) {
+    return engine.changeCount[(engine.changeHead + generation) % HISTORYCOUNT];
+}
+
+const noteChange_t *getChanges(u8 generation) {
+    return engine.changes[(engine.changeHead + generation) % HISTORYCOUNT];
 }
 
 uint16_t getModCV(uint8_t index) {
@@ -179,7 +249,7 @@ uint16_t getModCV(uint8_t index) {
 }
 
 uint8_t getModGate(uint8_t index) {
-    return engine.modGateOn[index];
+    return (engine.modGateOn >> index) & 1;
 }
 
 
@@ -211,92 +281,192 @@ void updateTrackParameters() {
     }
 }
 
+// full track update, needed after a reset or when track parameters change.
+// also sets how many steps are left until each track flips next
 void updateTrackValues() {
     engine.totalWeight = 0;
+    engine.trackOn = 0;
     for (uint8_t i = 0; i < TRACKCOUNT; i++) {
-        engine.trackOn[i] = ((engine.counter[i] + engine.phase[i]) / engine.divisor[i]) & 1;
-        engine.weightOn[i] = engine.trackOn[i] ? weights[i] : 0;
+        engine.trackOn |= (((engine.counter[i] + engine.phase[i]) / engine.divisor[i]) & 1) << i;
+        engine.nextFlip[i] = engine.divisor[i] - (engine.counter[i] + engine.phase[i]) % engine.divisor[i];
+        engine.weightOn[i] = TRACKON(i) ? weights[i] : 0;
         engine.totalWeight += engine.weightOn[i];
     }
+    
+    engine.tracksDirty = 0;
+    engine.changed = 0xFF;
 }
 
-void initHistory(void) {
-    for (uint8_t n = 0; n < NOTECOUNT; n++)
-        for (uint8_t h = 1; h < HISTORYCOUNT; h++) {
-            engine.notes[n][h] = 0;
-            engine.gateOn[n][h] = 0;
-            engine.gateChanged[n][h] = 0;
+// incremental track update for a step where all counters advanced by one
+void updateFlippedTracks() {
+    for (uint8_t i = 0; i < TRACKCOUNT; i++) {
+        if (--engine.nextFlip[i]) continue;
+        
+        engine.nextFlip[i] = engine.divisor[i];
+        engine.changed |= 1 << i;
+        engine.trackOn ^= 1 << i;
+        
+        if (TRACKON(i)) {
+            engine.weightOn[i] = weights[i];
+            engine.totalWeight += weights[i];
+        } else {
+            engine.weightOn[i] = 0;
+            engine.totalWeight -= weights[i];
         }
+    }
+}
+
+void updateSpaceMasks(void) {
+    // voices silenced by space for each value of the space counter
+    for (uint8_t c = 0; c < 16; c++) {
+        engine.spaceOff[c] = 0;
+        for (uint8_t n = 0; n < NOTECOUNT; n++)
+            if (spacePresets[(engine.config.space | n) % SPACEPRESETCOUNT] & c) engine.spaceOff[c] |= 1 << n;
+    }
+}
+
+void initHistory(void) {
+    for (uint8_t h = 1; h < HISTORYCOUNT; h++) {
+        for (uint8_t n = 0; n < NOTECOUNT; n++) engine.notes[n][h] = 0;
+        engine.gateOn[h] = 0;
+        engine.gateChanged[h] = 0;
+    }
+    
+    for (uint8_t h = 0; h < HISTORYCOUNT; h++) engine.changeCount[h] = 0;
 }
 
 void pushHistory(void) {
-    for (uint8_t n = 0; n < NOTECOUNT; n++)
-        for (int8_t h = HISTORYCOUNT - 1; h > 0; h--) {
-            engine.notes[n][h] = engine.notes[n][h-1];
-            engine.gateOn[n][h] = engine.gateOn[n][h-1];
-            engine.gateChanged[n][h] = engine.gateChanged[n][h-1];
-        }
+    for (int8_t h = HISTORYCOUNT - 1; h > 0; h--) {
+        for (uint8_t n = 0; n < NOTECOUNT; n++) engine.notes[n][h] = engine.notes[n][h-1];
+        engine.gateOn[h] = engine.gateOn[h-1];
+        engine.gateChanged[h] = engine.gateChanged[h-1];
+    }
+    
+    // change lists don't move, the oldest one is reused for this step
+    engine.changeHead = (engine.changeHead + HISTORYCOUNT - 1) % HISTORYCOUNT;
+    engine.changeCount[engine.changeHead] = 0;
 }
 
+// a voice is only recalculated if a track it depends on flipped or space
+// silenced or released it. otherwise its gate stays the same. the last voice
+// also depends on the other voices and is always recalculated
 void calculateNotes(void) {
-    for (uint8_t i = 0; i < NOTECOUNT; i++) calculateNextNote(i);
+    uint8_t space = engine.spaceOff[engine.spaceCounter];
+    uint8_t spaceChanged = space ^ engine.spaceMask;
+    engine.spaceMask = space;
+    
+    for (uint8_t i = 0; i < NOTECOUNT; i++) {
+        if (i == NOTECOUNT - 1 || (engine.changed & engine.gateDeps[i]) || (spaceChanged & (1 << i)))
+            calculateNextNote(i);
+        else
+            engine.gateChanged[0] &= ~((uint32_t)1 << i);
+    }
 }
 
 void calculateMods() {
-    for (uint8_t i = 0; i < MODCOUNT; i++) engine.modGateOn[i] = engine.trackOn[i % TRACKCOUNT];
+    if (!engine.changed) return;
+    
+    engine.modGateOn = engine.trackOn & ((1 << MODCOUNT) - 1);
 
     engine.modCvs[0] = engine.totalWeight + engine.weightOn[0];
-    engine.modCvs[1] = weights[1] * (engine.trackOn[3] + engine.trackOn[2]) + weights[2] * (engine.trackOn[0] + engine.trackOn[2]);
-    engine.modCvs[2] = weights[0] * (engine.trackOn[2] + engine.trackOn[1]) + weights[3] * (engine.trackOn[0] + engine.trackOn[3]);
-    engine.modCvs[3] = weights[1] * (engine.trackOn[1] + engine.trackOn[2]) + weights[2] * (engine.trackOn[2]  + engine.trackOn[3]) + weights[3] * (engine.trackOn[3] + engine.trackOn[2]);
+    engine.modCvs[1] = weights[1] * (TRACKON(3) + TRACKON(2)) + weights[2] * (TRACKON(0) + TRACKON(2));
+    engine.modCvs[2] = weights[0] * (TRACKON(2) + TRACKON(1)) + weights[3] * (TRACKON(0) + TRACKON(3));
+    engine.modCvs[3] = weights[1] * (TRACKON(1) + TRACKON(2)) + weights[2] * (TRACKON(2)  + TRACKON(3)) + weights[3] * (TRACKON(3) + TRACKON(2));
    
     for (uint8_t i = 0; i < MODCOUNT; i++) engine.modCvs[i] %= 10;
 }
 
-void calculateNote(int n) {
-    uint16_t note = 0;
-    uint8_t mask = engine.config.algoY >> 3;
+// note and gate kernels, one pair for each combination of the lower 3 bits of
+// algoY. the bits are compile time constants in each kernel, so the per step
+// path has no configuration branches. the masks derived from the upper bits
+// are expanded to track masks when algoY changes
+
+#define KERNELS(bits) \
+static uint16_t noteKernel##bits(int n) { \
+    uint16_t note = 0; \
+    for (uint8_t j = 0; j < TRACKCOUNT; j++) \
+        if (engine.noteTracks & (1 << j)) note += engine.weightOn[j]; \
+    if ((bits) & 1) note += engine.weightOn[(n + 1) % TRACKCOUNT]; \
+    if ((bits) & 2) note += engine.weightOn[(n + 2) % TRACKCOUNT]; \
+    if ((bits) & 4) note += engine.weightOn[(n + 3) % TRACKCOUNT]; \
+    return note; \
+} \
+static uint8_t gateKernel##bits(int n) { \
+    uint8_t gate = 0; \
+    if (engine.trackOn & engine.gateTracks[n]) gate = 1; \
+    if ((bits) & 1) gate ^= TRACKON(n % TRACKCOUNT) << 1; \
+    if ((bits) & 2) gate ^= TRACKON((n + 2) % TRACKCOUNT) << 2; \
+    if ((bits) & 4) gate ^= TRACKON((n + 3) % TRACKCOUNT) << 3; \
+    return gate; \
+}
+
+KERNELS(0)
+KERNELS(1)
+KERNELS(2)
+KERNELS(3)
+KERNELS(4)
+KERNELS(5)
+KERNELS(6)
+KERNELS(7)
+
+static const noteKernel_t noteKernels[8] = {
+    noteKernel0, noteKernel1, noteKernel2, noteKernel3,
+    noteKernel4, noteKernel5, noteKernel6, noteKernel7
+};
+
+static const gateKernel_t gateKernels[8] = {
+    gateKernel0, gateKernel1, gateKernel2, gateKernel3,
+    gateKernel4, gateKernel5, gateKernel6, gateKernel7
+};
 
-    for (uint8_t j = 0; j < TRACKCOUNT; j++) {
-        if (engine.trackOn[j] && (mask & (1 << (j & 3)))) note += engine.weightOn[j];
+void selectKernels(void) {
+    uint8_t mask = (engine.config.algoY >> 3) & 0b1111;
+    engine.noteTracks = mask | (mask << 4);
+    
+    for (uint8_t n = 0; n < NOTECOUNT; n++) {
+        mask = gatePresets[engine.config.algoY >> 3][n];
+        if (mask == 0) mask = 0b1111;
+        for (uint8_t i = 0; i < n; i++) mask = ((mask & 1) << 3) | (mask >> 1);
+        engine.gateTracks[n] = mask | (mask << 4);
+        
+        engine.gateDeps[n] = engine.gateTracks[n];
+        if (engine.config.algoY & 1) engine.gateDeps[n] |= 1 << (n % TRACKCOUNT);
+        if (engine.config.algoY & 2) engine.gateDeps[n] |= 1 << ((n + 2) % TRACKCOUNT);
+        if (engine.config.algoY & 4) engine.gateDeps[n] |= 1 << ((n + 3) % TRACKCOUNT);
     }
+    
+    noteKernel = noteKernels[engine.config.algoY & 7];
+    gateKernel = gateKernels[engine.config.algoY & 7];
+}
 
-    if (engine.config.algoY & 1) note += engine.weightOn[(n + 1) % TRACKCOUNT];
-    if (engine.config.algoY & 2) note += engine.weightOn[(n + 2) % TRACKCOUNT];
-    if (engine.config.algoY & 4) note += engine.weightOn[(n + 3) % TRACKCOUNT];
-   
-    note += engine.shifts[n];
+void calculateNote(int n) {
+    uint16_t note = noteKernel(n) + engine.shifts[n];
+    if (note >= NOTESUMCOUNT) note = NOTESUMCOUNT - 1;
     
-    uint8_t octave = (note / 12 < 2 ? note / 12 : 2) * 12;
-    engine.notes[n][0] = engine.scaleCount[engine.scale] ? engine.scales[engine.scale][note % engine.scaleCount[engine.scale]] + octave : 0;
+    engine.notes[n][0] = engine.pitches[engine.scale][note];
 }
    
 void calculateNextNote(int n) {
-    uint8_t mask = gatePresets[engine.config.algoY >> 3][n];
-    if (mask == 0) mask = 0b1111;
-    for (uint8_t i = 0; i < n; i++) mask = ((mask & 1) << 3) | (mask >> 1);
-   
-    uint8_t gate = 0;
-    for (uint8_t j = 0; j < TRACKCOUNT; j++) {
-        if (engine.trackOn[j] && (mask & (1 << (j & 3)))) gate = 1;
-        // if (mask & (1 << j)) gate = 1;
-    }
-
-    if (engine.config.algoY & 1) gate ^= engine.trackOn[n % TRACKCOUNT] << 1;
-    if (engine.config.algoY & 2) gate ^= engine.trackOn[(n + 2) % TRACKCOUNT] << 2;
-    if (engine.config.algoY & 4) gate ^= engine.trackOn[(n + 3) % TRACKCOUNT] << 3;
+    uint8_t gate = gateKernel(n);
     
-    uint8_t previousGatesOn = 1;
-    for (uint8_t i = 0; i < NOTECOUNT - 1; i++) previousGatesOn &= engine.gateChanged[i][0] & engine.gateOn[i][0];
-    if (n == NOTECOUNT - 1 && previousGatesOn) gate = 0;
+    uint32_t previousGates = (1 << (NOTECOUNT - 1)) - 1;
+    if (n == NOTECOUNT - 1 && (engine.gateChanged[0] & engine.gateOn[0] & previousGates) == previousGates) gate = 0;
     
-    u8 space = spacePresets[(engine.config.space | n) % SPACEPRESETCOUNT];
-    space |= space << 4;
-    if (spacePresets[(engine.config.space | n) % SPACEPRESETCOUNT] & engine.spaceCounter) gate = 0;
+    if (engine.spaceMask & (1 << n)) gate = 0;
    
     if (!engine.scaleCount[engine.scale]) gate = 0;
    
-    engine.gateChanged[n][0] = engine.gateOn[n][0] != gate;
-    engine.gateOn[n][0] = gate;
-    if (engine.gateChanged[n][0]) calculateNote(n);
+    uint32_t planes = (uint32_t)((gate & 1) | ((gate & 2) << 7) | ((gate & 4) << 14) | ((gate & 8) << 21)) << n;
+    uint32_t voice = (uint32_t)0x01010101 << n;
+    uint8_t changed = (engine.gateOn[0] & voice) != planes;
+    
+    engine.gateOn[0] = (engine.gateOn[0] & ~voice) | planes;
+    engine.gateChanged[0] = (engine.gateChanged[0] & ~((uint32_t)1 << n)) | ((uint32_t)changed << n);
+    if (!changed) return;
+    
+    calculateNote(n);
+    noteChange_t *change = &engine.changes[engine.changeHead][engine.changeCount[engine.changeHead]++];
+    change->voice = n;
+    change->note = engine.notes[n][0];
+    change->gate = gate;
 }
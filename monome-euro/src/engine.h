@@ -9,11 +9,20 @@
 
 #define SCALELEN 12
 #define SCALECOUNT 4
+#define NOTESUMCOUNT 64
 
 #define NOTECOUNT 8
 #define HISTORYCOUNT 8
 #define MODCOUNT 4
 
+// gate values are 4 bits, stored as 4 bitplanes packed into one word per
+// generation. each plane is a byte with one bit per voice
+#define GATEPLANES 4
+#define GATEPLANESTRIDE 8
+#if NOTECOUNT > GATEPLANESTRIDE || GATEPLANES * GATEPLANESTRIDE > 32 || TRACKCOUNT > 8 || MODCOUNT > 8
+#error "gate and track bitplanes don't fit"
+#endif
+
 
 typedef struct {
     uint8_t length;
@@ -24,6 +33,16 @@ typedef struct {
 } engine_config_t;
 
 
+// a voice whose gate changed on a step, with its new note and gate. clock()
+// pushes one for each such voice, and the list for a generation is the list
+// pushed that many steps ago
+typedef struct {
+    uint8_t voice;
+    uint8_t note;
+    uint8_t gate;
+} noteChange_t;
+
+
 typedef struct {
     engine_config_t config;
     uint16_t globalCounter;
@@ -32,24 +51,38 @@ typedef struct {
     uint8_t counter[TRACKCOUNT];
     uint8_t divisor[TRACKCOUNT];
     uint8_t phase[TRACKCOUNT];
+    uint8_t nextFlip[TRACKCOUNT];
+    uint8_t tracksDirty;
+    uint8_t changed;
 
-    uint8_t trackOn[TRACKCOUNT];
+    uint8_t trackOn;
     uint8_t weightOn[TRACKCOUNT];
     uint16_t totalWeight;
     
     uint8_t shifts[NOTECOUNT];
+    
+    uint8_t noteTracks;
+    uint8_t gateTracks[NOTECOUNT];
+    uint8_t gateDeps[NOTECOUNT];
+    uint8_t spaceOff[16];
+    uint8_t spaceMask;
 
     uint8_t scales[SCALECOUNT][SCALELEN];
     uint8_t scaleCount[SCALECOUNT];
+    uint8_t pitches[SCALECOUNT][NOTESUMCOUNT];
     uint8_t scale;
     
     uint8_t notes[NOTECOUNT][HISTORYCOUNT];
-    uint8_t gateOn[NOTECOUNT][HISTORYCOUNT];
-    uint8_t gateChanged[NOTECOUNT][HISTORYCOUNT];
+    uint32_t gateOn[HISTORYCOUNT];
+    uint32_t gateChanged[HISTORYCOUNT];
+    
+    noteChange_t changes[HISTORYCOUNT][NOTECOUNT];
+    uint8_t changeCount[HISTORYCOUNT];
+    uint8_t changeHead;
     
     uint16_t modCvs[MODCOUNT];
-    uint8_t modGateOn[MODCOUNT];
-    uint8_t modGateChanged[MODCOUNT];
+    uint8_t modGateOn;
+    uint8_t modGateChanged;
 } engine_t;
 
 
@@ -69,6 +102,7 @@ void updateShift(uint8_t shift);
 void updateSpace(uint8_t space);
 
 void clock(void);
+uint8_t recalculate(void);
 void reset(void);
 uint8_t isReset(void);
 uint8_t getCurrentStep(void);uint8_t getCurrentStep(void);
@@ -80,5 +114,7 @@ uint8_t getScaleCount(uint8_t scale);
 uint8_t getNote(uint8_t index, u8 generation);
 uint8_t getGate(uint8_t index, u8 generation);
 uint8_t getGateChanged(uint8_t index, u8 generation);
+uint8_t getChangeCount(u8 generation);
+const noteChange_t *getChanges(u8 generation);
 uint16_t getModCV(uint8_t index);
 uint8_t getModGate(uint8_t index);
@@ -0,0 +1,177 @@
+// ----------------------------------------------------------------------------
+// preset bank reader
+//
+// see bank_reader.h
+// ----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "bank_reader.h"
+
+static const bank_field_t shared_fields[] = SHARED_BANK_FIELDS;
+static const bank_field_t preset_fields[] = PRESET_BANK_FIELDS;
+
+#define SHAREDFIELDCOUNT (sizeof(shared_fields) / sizeof(bank_field_t))
+#define PRESETFIELDCOUNT (sizeof(preset_fields) / sizeof(bank_field_t))
+
+
+// ----------------------------------------------------------------------------
+// helpers
+
+static uint32_t crc32(uint32_t c, uint8_t byte) {
+    c ^= byte;
+    for (uint8_t b = 0; b < 8; b++) c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+    return c;
+}
+
+static uint16_t record_len(const bank_field_t *fields, uint8_t count) {
+    uint16_t len = 0;
+    for (uint8_t f = 0; f < count; f++) len += fields[f].size * fields[f].count;
+    return len;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int is_bank_line(const char *line, size_t len) {
+    // up to BANKLINELEN bytes as hex
+    if (!len || len > 64 || len & 1) return 0;
+    for (size_t i = 0; i < len; i++)
+        if (hex_digit(line[i]) < 0) return 0;
+    return 1;
+}
+
+static int read_line(bank_reader_t *bank) {
+    // CR and LF both end a line. a line too long for the buffer is cut, the
+    // rest is dropped
+    int c = fgetc(bank->in);
+    if (c == EOF) return 0;
+
+    bank->len = 0;
+    for (; c != EOF && c != '\r' && c != '\n'; c = fgetc(bank->in))
+        if (bank->len < sizeof(bank->line) - 1) bank->line[bank->len++] = c;
+    bank->line[bank->len] = 0;
+    bank->pos = 0;
+    return 1;
+}
+
+static int next_byte(bank_reader_t *bank) {
+    if (!bank->is_hex) return fgetc(bank->in);
+    if (bank->is_error) return EOF;
+
+    // the lines between the "bank" and "end" lines of the debug output,
+    // empty lines are skipped
+    while (bank->pos >= bank->len) {
+        if (!read_line(bank)) return EOF;
+        if (!bank->len) continue;
+
+        if (!bank->is_started) {
+            bank->is_started = !strcmp(bank->line, "bank");
+            bank->len = 0;
+            continue;
+        }
+        if (!strcmp(bank->line, "end")) return EOF;
+
+        if (!is_bank_line(bank->line, bank->len)) {
+            fprintf(stderr, "not a line of a bank export: %s\n", bank->line);
+            bank->is_error = 1;
+            return EOF;
+        }
+    }
+
+    int byte = (hex_digit(bank->line[bank->pos]) << 4) | hex_digit(bank->line[bank->pos + 1]);
+    bank->pos += 2;
+    return byte;
+}
+
+static int read_value(bank_reader_t *bank, uint8_t size, uint32_t *value) {
+    *value = 0;
+    for (uint8_t b = 0; b < size; b++) {
+        int byte = next_byte(bank);
+        if (byte == EOF) return 0;
+        bank->crc = crc32(bank->crc, byte);
+        *value |= (uint32_t)byte << (b * 8);
+    }
+    return 1;
+}
+
+static int read_record(bank_reader_t *bank, const char *name, int index, const bank_field_t *fields, uint8_t count, uint8_t *record) {
+    uint32_t value, expected;
+
+    for (uint8_t f = 0; f < count; f++) {
+        for (uint16_t e = 0; e < fields[f].count; e++) {
+            if (!read_value(bank, fields[f].size, &value)) {
+                if (!bank->is_error) fprintf(stderr, "bank is truncated\n");
+                return 0;
+            }
+
+            uint8_t *v = record + fields[f].offset + e * fields[f].size;
+            if (fields[f].size == 1) *v = value;
+            else if (fields[f].size == 2) *(uint16_t *)v = value;
+            else *(uint32_t *)v = value;
+        }
+    }
+
+    expected = ~bank->crc;
+    if (!read_value(bank, 4, &value)) {
+        if (!bank->is_error) fprintf(stderr, "bank is truncated\n");
+        return 0;
+    }
+    if (value != expected) {
+        if (index < 0) fprintf(stderr, "%s: checksum mismatch\n", name); else fprintf(stderr, "%s %d: checksum mismatch\n", name, index);
+        return 0;
+    }
+
+    bank->crc = 0xFFFFFFFF;
+    return 1;
+}
+
+
+// ----------------------------------------------------------------------------
+// reading
+
+int open_bank(bank_reader_t *bank, FILE *in, int is_hex) {
+    uint8_t header[BANK_HEADER_LEN];
+    uint32_t value;
+
+    memset(bank, 0, sizeof(bank_reader_t));
+    bank->in = in;
+    bank->is_hex = is_hex;
+    bank->crc = 0xFFFFFFFF;
+
+    for (uint8_t i = 0; i < BANK_HEADER_LEN; i++) {
+        if (!read_value(bank, 1, &value)) {
+            if (!bank->is_error) fprintf(stderr, "no bank found\n");
+            return 0;
+        }
+        header[i] = value;
+    }
+
+    if (memcmp(header, BANK_MAGIC, 4) || header[4] != BANK_VERSION) {
+        fprintf(stderr, "not a version %d preset bank\n", BANK_VERSION);
+        return 0;
+    }
+
+    if ((header[6] | (header[7] << 8)) != record_len(shared_fields, SHAREDFIELDCOUNT) ||
+        (header[8] | (header[9] << 8)) != record_len(preset_fields, PRESETFIELDCOUNT)) {
+        fprintf(stderr, "bank has different record lengths\n");
+        return 0;
+    }
+
+    bank->version = header[4];
+    bank->preset_count = header[5];
+    return 1;
+}
+
+int read_shared_record(bank_reader_t *bank, shared_data_t *shared) {
+    // the header is covered by the CRC of the shared record
+    return read_record(bank, "shared", -1, shared_fields, SHAREDFIELDCOUNT, (uint8_t *)shared);
+}
+
+int read_preset_record(bank_reader_t *bank, uint8_t index, preset_data_t *preset) {
+    return read_record(bank, "preset", index, preset_fields, PRESETFIELDCOUNT, (uint8_t *)preset);
+}
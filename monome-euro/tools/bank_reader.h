@@ -0,0 +1,30 @@
+// ----------------------------------------------------------------------------
+// preset bank reader
+//
+// reads a preset bank in the format described in control.h one record at a
+// time, into shared_data_t and preset_data_t, and checks every record's CRC.
+// a bank is read from its binary form or from an export in the debug output,
+// in the form described in control.h. errors are printed, and the functions
+// return 0
+//
+// built together with the tools that read banks, for example:
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o bank_tool bank_tool.c bank_reader.c
+// ----------------------------------------------------------------------------
+
+#pragma once
+#include <stdio.h>
+
+#include "control.h"
+
+typedef struct {
+    FILE *in;
+    int is_hex, is_started, is_error;
+    char line[256];
+    size_t pos, len;
+    uint32_t crc;
+    uint8_t version, preset_count;
+} bank_reader_t;
+
+int open_bank(bank_reader_t *bank, FILE *in, int is_hex);
+int read_shared_record(bank_reader_t *bank, shared_data_t *shared);
+int read_preset_record(bank_reader_t *bank, uint8_t index, preset_data_t *preset);
@@ -0,0 +1,198 @@
+// ----------------------------------------------------------------------------
+// preset bank converter
+//
+// converts preset banks between the binary format described in control.h and
+// a readable text form with one line per field, and checks every record's
+// CRC on the way. banks are processed one record at a time, banks are read
+// with bank_reader
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o bank_tool bank_tool.c bank_reader.c
+//
+// usage:
+//   bank_tool decode bank.bin > bank.txt
+//   bank_tool decode -x debug.log > bank.txt   (hex lines from an export)
+//   bank_tool encode bank.txt > bank.bin
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bank_reader.h"
+
+static const bank_field_t shared_fields[] = SHARED_BANK_FIELDS;
+static const bank_field_t preset_fields[] = PRESET_BANK_FIELDS;
+
+#define SHAREDFIELDCOUNT (sizeof(shared_fields) / sizeof(bank_field_t))
+#define PRESETFIELDCOUNT (sizeof(preset_fields) / sizeof(bank_field_t))
+
+static FILE *in;
+static int is_hex;
+static uint32_t crc;
+static unsigned line_number;
+
+
+// ----------------------------------------------------------------------------
+// helpers
+
+static uint32_t crc32(uint32_t c, uint8_t byte) {
+    c ^= byte;
+    for (uint8_t b = 0; b < 8; b++) c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+    return c;
+}
+
+static uint16_t record_len(const bank_field_t *fields, uint8_t count) {
+    uint16_t len = 0;
+    for (uint8_t f = 0; f < count; f++) len += fields[f].size * fields[f].count;
+    return len;
+}
+
+static void write_value(uint8_t size, uint32_t value) {
+    for (uint8_t b = 0; b < size; b++) {
+        crc = crc32(crc, value >> (b * 8));
+        putchar((value >> (b * 8)) & 0xFF);
+    }
+}
+
+static void write_crc(void) {
+    uint32_t c = ~crc;
+    for (uint8_t b = 0; b < 4; b++) putchar((c >> (b * 8)) & 0xFF);
+    crc = 0xFFFFFFFF;
+}
+
+
+// ----------------------------------------------------------------------------
+// binary to text
+
+static void print_record(const char *name, int index, const bank_field_t *fields, uint8_t count, uint8_t *record) {
+    if (index < 0) printf("%s\n", name); else printf("%s %d\n", name, index);
+
+    for (uint8_t f = 0; f < count; f++) {
+        printf("%s", fields[f].name);
+        for (uint16_t e = 0; e < fields[f].count; e++) {
+            uint8_t *v = record + fields[f].offset + e * fields[f].size;
+            if (fields[f].size == 1)
+                printf(fields[f].is_signed ? " %d" : " %u", fields[f].is_signed ? *(int8_t *)v : *v);
+            else if (fields[f].size == 2)
+                printf(fields[f].is_signed ? " %d" : " %u", fields[f].is_signed ? *(int16_t *)v : *(uint16_t *)v);
+            else
+                printf(fields[f].is_signed ? " %d" : " %u", *(uint32_t *)v);
+        }
+        printf("\n");
+    }
+}
+
+static int decode(void) {
+    bank_reader_t bank;
+    shared_data_t shared;
+    preset_data_t preset;
+
+    if (!open_bank(&bank, in, is_hex)) return 1;
+    printf("bank %d %d\n", bank.version, bank.preset_count);
+
+    if (!read_shared_record(&bank, &shared)) return 1;
+    print_record("shared", -1, shared_fields, SHAREDFIELDCOUNT, (uint8_t *)&shared);
+
+    for (uint8_t i = 0; i < bank.preset_count; i++) {
+        if (!read_preset_record(&bank, i, &preset)) return 1;
+        print_record("preset", i, preset_fields, PRESETFIELDCOUNT, (uint8_t *)&preset);
+    }
+
+    fprintf(stderr, "%d presets, all checksums match\n", bank.preset_count);
+    return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// text to binary
+
+static char *next_line(char **line, size_t *size) {
+    while (getline(line, size, in) >= 0) {
+        line_number++;
+        (*line)[strcspn(*line, "\r\n")] = 0;
+        if (**line) return *line;
+    }
+    return NULL;
+}
+
+static int encode_record(const char *name, int index, const bank_field_t *fields, uint8_t count, char **line, size_t *size) {
+    char section[32];
+
+    if (index < 0) snprintf(section, sizeof(section), "%s", name); else snprintf(section, sizeof(section), "%s %d", name, index);
+    if (!next_line(line, size) || strcmp(*line, section)) {
+        fprintf(stderr, "line %u: expected \"%s\"\n", line_number, section);
+        return 0;
+    }
+
+    for (uint8_t f = 0; f < count; f++) {
+        if (!next_line(line, size) || strtok(*line, " ") == NULL || strcmp(*line, fields[f].name)) {
+            fprintf(stderr, "line %u: expected %s\n", line_number, fields[f].name);
+            return 0;
+        }
+
+        for (uint16_t e = 0; e < fields[f].count; e++) {
+            char *token = strtok(NULL, " ");
+            if (!token) {
+                fprintf(stderr, "line %u: %s needs %d values\n", line_number, fields[f].name, fields[f].count);
+                return 0;
+            }
+            write_value(fields[f].size, (uint32_t)strtol(token, NULL, 0));
+        }
+    }
+
+    write_crc();
+    return 1;
+}
+
+static int encode(void) {
+    char *line = NULL;
+    size_t size = 0;
+    int version, count;
+
+    if (!next_line(&line, &size) || sscanf(line, "bank %d %d", &version, &count) != 2 || version != BANK_VERSION || count < 0 || count > 255) {
+        fprintf(stderr, "line %u: expected \"bank %d <preset count>\"\n", line_number, BANK_VERSION);
+        return 1;
+    }
+
+    uint16_t shared_len = record_len(shared_fields, SHAREDFIELDCOUNT);
+    uint16_t preset_len = record_len(preset_fields, PRESETFIELDCOUNT);
+    uint8_t header[BANK_HEADER_LEN] = {
+        BANK_MAGIC[0], BANK_MAGIC[1], BANK_MAGIC[2], BANK_MAGIC[3], BANK_VERSION, count,
+        shared_len & 0xFF, shared_len >> 8, preset_len & 0xFF, preset_len >> 8
+    };
+
+    crc = 0xFFFFFFFF;
+    for (uint8_t i = 0; i < BANK_HEADER_LEN; i++) write_value(1, header[i]);
+
+    int ok = encode_record("shared", -1, shared_fields, SHAREDFIELDCOUNT, &line, &size);
+    for (int i = 0; ok && i < count; i++)
+        ok = encode_record("preset", i, preset_fields, PRESETFIELDCOUNT, &line, &size);
+
+    free(line);
+    return !ok;
+}
+
+int main(int argc, char **argv) {
+    int arg = 2;
+
+    if (argc > 2 && !strcmp(argv[1], "decode") && !strcmp(argv[2], "-x")) {
+        is_hex = 1;
+        arg++;
+    }
+
+    if (argc != arg + 1 || (strcmp(argv[1], "decode") && strcmp(argv[1], "encode"))) {
+        fprintf(stderr, "usage:\n  %s decode [-x] bank.bin > bank.txt\n  %s encode bank.txt > bank.bin\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    in = fopen(argv[arg], is_hex || !strcmp(argv[1], "encode") ? "r" : "rb");
+    if (!in) {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    int result = !strcmp(argv[1], "decode") ? decode() : encode();
+    fclose(in);
+    return result;
+}
@@ -0,0 +1,102 @@
+// ----------------------------------------------------------------------------
+// boot check
+//
+// boots the firmware on flash that has never been written, with writes that
+// block like the real ones, and reports the flash writes, the time they take
+// and when the first note plays. slots are only written when they are first
+// saved, so boot shouldn't depend on the number of slots. then boots on flash
+// written in the layout from before FLASHVERSION, which has to keep the
+// shared data and every preset
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o boot_check boot_check.c host_multipass.c ../src/control.c ../src/engine.c
+//
+// usage:
+//   boot_check [preset write ms] [shared write ms]
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_multipass.h"
+
+extern preset_data_t p;
+extern u8 selected_preset;
+
+// flash_layout_v0_t with every slot
+typedef struct {
+    u8 fresh;
+    u8 preset_index;
+    shared_data_v0_t shared;
+    preset_data_v0_t presets[HOSTPRESETCOUNT];
+} old_flash_t;
+
+static old_flash_t old_flash;
+
+static u64 first_note;
+
+static void note_played(u8 voice, u16 pitch, u16 volume, u8 on) {
+    if (on && !first_note) first_note = host_time;
+}
+
+int main(int argc, char **argv) {
+    host_preset_write_ms = argc > 1 ? atoi(argv[1]) : 12;
+    host_shared_write_ms = argc > 2 ? atoi(argv[2]) : 4;
+    host_note = note_played;
+    int is_ok = 1;
+
+    // first boot
+    host_boot();
+    u64 boot_time = host_time;
+    u32 boot_writes = host_flash_writes;
+    while (!first_note && host_time < 10000) host_run(host_time + 1);
+
+    u8 is_unwritten = 1;
+    for (u8 i = 0; i < HOSTPRESETCOUNT; i++)
+        if (host_flash.presets[i].speed) is_unwritten = 0;
+
+    printf("first boot: %d flash writes taking %dms, first note at %dms, %s\n", boot_writes, (int)boot_time, (int)first_note,
+        is_unwritten ? "no slots written" : "slots written");
+    if (!is_unwritten || !first_note) is_ok = 0;
+
+    // flash from the older version, every slot written with its own values
+    memset(&old_flash, 0, sizeof(old_flash));
+    old_flash.preset_index = 3;
+    old_flash.shared.mi = 2;
+    old_flash.shared.i2c_device[1] = 1;
+    old_flash.shared.run = 0;
+    for (u8 i = 0; i < HOSTPRESETCOUNT; i++) {
+        memcpy(&old_flash.presets[i], &p, sizeof(preset_data_v0_t));
+        old_flash.presets[i].config.length = 1 + i;
+        old_flash.presets[i].speed = 100 + i;
+        old_flash.presets[i].transpose[0] = -i;
+        old_flash.presets[i].matrix[1][3][6][10] = i;
+        old_flash.presets[i].voice_on[NOTECOUNT - 1] = i & 1;
+    }
+    memset(&host_flash, 0xAA, sizeof(host_flash));
+    memcpy(&host_flash, &old_flash, sizeof(old_flash));
+
+    host_flash_writes = 0;
+    host_boot();
+
+    u8 is_kept = host_flash.shared.mi == 2 && host_flash.shared.i2c_device[1] == 1 && !host_flash.shared.run;
+    for (u8 i = 0; i < HOSTPRESETCOUNT; i++) {
+        preset_data_t *preset = &host_flash.presets[i];
+        if (preset->config.length != 1 + i || preset->speed != 100 + i || preset->transpose[0] != -i ||
+            preset->matrix[1][3][6][10] != i || preset->voice_on[NOTECOUNT - 1] != (i & 1) ||
+            !preset->seed || (i && preset->seed == host_flash.presets[i - 1].seed)) {
+            printf("older flash: preset %d lost\n", i);
+            is_kept = 0;
+        }
+    }
+    for (u8 i = 0; i < MAXPRESETCOUNT / 8; i++)
+        if (host_flash.shared.saved_presets[i] != 0xFF) is_kept = 0;
+    if (selected_preset != 3 || p.speed != 103) is_kept = 0;
+
+    printf("older flash: %d flash writes, version %08x, shared data and %d presets %s\n", host_flash_writes,
+        host_flash.shared.version, HOSTPRESETCOUNT, is_kept ? "kept" : "lost");
+    if (!is_kept || host_flash.shared.version != FLASHVERSION) is_ok = 0;
+
+    return !is_ok;
+}
@@ -0,0 +1,65 @@
+// ----------------------------------------------------------------------------
+// internal clock check
+//
+// runs the internal clock at a few speeds and measures the clock output
+// against the exact step length. ticks land on whole milliseconds, so each
+// one can be up to 1ms off (jitter), but the total time over all steps should
+// stay within 1ms of the exact one (drift). with -w the run starts just before
+// the millisecond time wraps, which has to leave the clock unaffected
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o clock_check clock_check.c host_multipass.c ../src/control.c ../src/engine.c
+//
+// usage:
+//   clock_check [-w] [steps]
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_multipass.h"
+
+#define WRAPLEAD 3000
+
+extern preset_data_t p;
+
+int main(int argc, char **argv) {
+    int arg = 1, is_wrapping = 0;
+    if (argc > 1 && !strcmp(argv[1], "-w")) {
+        is_wrapping = 1;
+        arg++;
+    }
+
+    u32 steps = argc > arg ? atoi(argv[arg]) : 10000;
+    if (steps < 2 || steps >= HOSTCLOCKLOG) steps = HOSTCLOCKLOG - 1;
+
+    u16 speeds[] = { 1996, 1700, 772, 332 };
+    int is_ok = 1;
+
+    for (u8 s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++) {
+        host_is_flash_new = 1;
+        host_time = is_wrapping ? 0x100000000ull - WRAPLEAD : 0;
+        host_boot();
+        p.speed = speeds[s];
+
+        // the first tick was timed for the default speed
+        host_run(host_time + 2 * 60000 / p.speed + 1);
+        host_clock_count = 0;
+        host_run(host_time + (u64)steps * 60000 / p.speed + 1);
+
+        double period = 60000.0 / p.speed, jitter = 0;
+        for (u32 i = 1; i < host_clock_count; i++) {
+            double d = (host_clock_times[i] - host_clock_times[i - 1]) - period;
+            if (d < 0) d = -d;
+            if (d > jitter) jitter = d;
+        }
+
+        double drift = (host_clock_times[host_clock_count - 1] - host_clock_times[0]) - (host_clock_count - 1) * period;
+        printf("speed %4d: %5d steps of %.3fms, jitter %.3fms, drift %+.3fms\n", p.speed, host_clock_count, period, jitter, drift);
+        if (jitter >= 1 || drift <= -1 || drift >= 1) is_ok = 0;
+    }
+
+    printf(is_ok ? "clock stays within 1ms\n" : "clock is off by 1ms or more\n");
+    return !is_ok;
+}
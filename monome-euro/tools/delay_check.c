@@ -0,0 +1,71 @@
+// ----------------------------------------------------------------------------
+// note delay check
+//
+// runs the firmware at a few speeds with voice n delayed by n/8 of a step
+// and compares the delays control.c sets for the notes with the exact ones.
+// timers only have 1ms resolution, so a single delay can be up to 1ms off,
+// but the total over all notes of a voice should stay within 1ms
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o delay_check delay_check.c host_multipass.c ../src/control.c ../src/engine.c
+//
+// usage:
+//   delay_check [steps]
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "host_multipass.h"
+
+// as in control.c
+#define NOTEDELAYTIMER 80
+
+extern preset_data_t p;
+
+static u32 notes[NOTECOUNT];
+static int64_t error_us[NOTECOUNT], worst_us[NOTECOUNT];
+
+static void timer_added(u8 index, u16 ms) {
+    if (index < NOTEDELAYTIMER || index >= NOTEDELAYTIMER + NOTECOUNT) return;
+    u8 voice = index - NOTEDELAYTIMER;
+
+    u32 period = 60000000 / p.speed;
+    error_us[voice] += (int64_t)ms * 1000 - (int64_t)period * voice / 8;
+    notes[voice]++;
+
+    int64_t error = error_us[voice] < 0 ? -error_us[voice] : error_us[voice];
+    if (error > worst_us[voice]) worst_us[voice] = error;
+}
+
+int main(int argc, char **argv) {
+    u32 steps = argc > 1 ? atoi(argv[1]) : 10000;
+    u16 speeds[] = { 1996, 1700, 772, 332 };
+    int is_ok = 1;
+
+    host_timer_added = timer_added;
+
+    for (u8 s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++) {
+        host_is_flash_new = 1;
+        host_boot();
+
+        p.speed = speeds[s];
+        p.swing = 0;
+        p.delay_width = 1;
+        for (u8 n = 0; n < NOTECOUNT; n++) p.note_delay[n] = n;
+
+        for (u8 n = 0; n < NOTECOUNT; n++) notes[n] = error_us[n] = worst_us[n] = 0;
+        host_run(host_time + (u64)steps * 60000 / speeds[s]);
+
+        printf("speed %4d:", speeds[s]);
+        for (u8 n = 1; n < NOTECOUNT; n++) {
+            printf(" %d/8 %5d notes %+.2fms (worst %.2f)", n, notes[n], error_us[n] / 1000.0, worst_us[n] / 1000.0);
+            if (worst_us[n] > 1000) is_ok = 0;
+        }
+        printf("\n");
+    }
+
+    printf(is_ok ? "every voice stays within 1ms\n" : "delays drift by more than 1ms\n");
+    return !is_ok;
+}
@@ -0,0 +1,261 @@
+// ----------------------------------------------------------------------------
+// engine output traces
+//
+// records the engine outputs for every step into a compact binary trace and
+// finds the first step where two traces diverge, so engine changes can be
+// checked against a previous build
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/libavr32/src -o engine_trace engine_trace.c ../src/engine.c
+//
+// usage:
+//   engine_trace record out.trace [steps] [length] [algoX] [algoY] [shift] [space]
+//   engine_trace diff a.trace b.trace
+//
+// format: a header (magic, version, counts and the config) followed by one
+// record per step. each step holds the fields that differ from the value
+// predicted from the previous step, as varint (field, value) pairs preceded by
+// their count. history generations are predicted by shifting the previous
+// step, generation 0 and mod outputs by their previous value, so a typical
+// step takes a few bytes. records are written as the engine runs and read
+// back from a memory mapped file
+// ----------------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+#define TRACEMAGIC "OHET"
+#define TRACEVERSION 1
+
+#define VOICEFIELDS (NOTECOUNT * HISTORYCOUNT)
+#define FIELD_NOTE 0
+#define FIELD_GATE (FIELD_NOTE + VOICEFIELDS)
+#define FIELD_CHANGED (FIELD_GATE + VOICEFIELDS)
+#define FIELD_MODCV (FIELD_CHANGED + VOICEFIELDS)
+#define FIELD_MODGATE (FIELD_MODCV + MODCOUNT)
+#define FIELDCOUNT (FIELD_MODGATE + MODCOUNT)
+
+typedef struct {
+    uint16_t values[FIELDCOUNT];
+} trace_state_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size, pos;
+    uint32_t step;
+    trace_state_t state;
+} trace_reader_t;
+
+
+// ----------------------------------------------------------------------------
+// encoding
+
+static void predict(trace_state_t *state) {
+    // history is a shift register, so generation g is expected to hold what
+    // generation g - 1 held on the previous step
+    for (uint8_t f = 0; f < 3; f++)
+        for (uint8_t n = 0; n < NOTECOUNT; n++) {
+            uint16_t *v = &state->values[f * VOICEFIELDS + n * HISTORYCOUNT];
+            for (uint8_t g = HISTORYCOUNT - 1; g > 0; g--) v[g] = v[g - 1];
+        }
+}
+
+static void capture(trace_state_t *state) {
+    for (uint8_t n = 0; n < NOTECOUNT; n++)
+        for (uint8_t g = 0; g < HISTORYCOUNT; g++) {
+            state->values[FIELD_NOTE + n * HISTORYCOUNT + g] = getNote(n, g);
+            state->values[FIELD_GATE + n * HISTORYCOUNT + g] = getGate(n, g);
+            state->values[FIELD_CHANGED + n * HISTORYCOUNT + g] = getGateChanged(n, g);
+        }
+    
+    for (uint8_t m = 0; m < MODCOUNT; m++) {
+        state->values[FIELD_MODCV + m] = getModCV(m);
+        state->values[FIELD_MODGATE + m] = getModGate(m);
+    }
+}
+
+static size_t put_varint(uint8_t *out, uint32_t v) {
+    size_t len = 0;
+    while (v >= 0x80) {
+        out[len++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    out[len++] = v;
+    return len;
+}
+
+static int get_varint(trace_reader_t *r, uint32_t *v) {
+    *v = 0;
+    for (uint8_t shift = 0; r->pos < r->size && shift < 32; shift += 7) {
+        uint8_t b = r->data[r->pos++];
+        *v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return 1;
+    }
+    return 0;
+}
+
+static int record(const char *path, uint32_t steps, engine_config_t *config) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    
+    uint8_t header[] = {
+        TRACEMAGIC[0], TRACEMAGIC[1], TRACEMAGIC[2], TRACEMAGIC[3], TRACEVERSION,
+        NOTECOUNT, HISTORYCOUNT, MODCOUNT,
+        config->length, config->algoX, config->algoY, config->shift, config->space
+    };
+    fwrite(header, 1, sizeof(header), f);
+    
+    uint8_t scales[SCALECOUNT][SCALELEN] = {{ 0 }};
+    for (uint8_t s = 0; s < SCALECOUNT; s++)
+        scales[s][0] = scales[s][3] = scales[s][5] = scales[s][7] = 1;
+    updateScales(scales);
+    setCurrentScale(0);
+    initEngine(config);
+    
+    trace_state_t previous, current;
+    memset(&previous, 0, sizeof(previous));
+    
+    uint8_t buffer[FIELDCOUNT * 6 + 5], changes[FIELDCOUNT * 6];
+    
+    for (uint32_t step = 0; step < steps; step++) {
+        clock();
+        predict(&previous);
+        capture(&current);
+        
+        size_t len = 0;
+        uint32_t count = 0;
+        for (uint16_t i = 0; i < FIELDCOUNT; i++) {
+            if (current.values[i] == previous.values[i]) continue;
+            len += put_varint(changes + len, i);
+            len += put_varint(changes + len, current.values[i]);
+            count++;
+        }
+        
+        size_t head = put_varint(buffer, count);
+        memcpy(buffer + head, changes, len);
+        fwrite(buffer, 1, head + len, f);
+        
+        previous = current;
+    }
+    
+    fclose(f);
+    return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+// decoding
+
+static int open_trace(const char *path, trace_reader_t *r) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return 0;
+    }
+    
+    memset(r, 0, sizeof(*r));
+    r->size = st.st_size;
+    r->data = r->size ? mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    
+    if (r->size < 13 || r->data == MAP_FAILED || memcmp(r->data, TRACEMAGIC, 4) || r->data[4] != TRACEVERSION) {
+        fprintf(stderr, "%s: not an engine trace\n", path);
+        return 0;
+    }
+    
+    if (r->data[5] != NOTECOUNT || r->data[6] != HISTORYCOUNT || r->data[7] != MODCOUNT) {
+        fprintf(stderr, "%s: recorded with different voice counts\n", path);
+        return 0;
+    }
+    
+    r->pos = 13;
+    return 1;
+}
+
+static int next_step(trace_reader_t *r) {
+    uint32_t count, field, value;
+    
+    if (r->pos >= r->size || !get_varint(r, &count)) return 0;
+    
+    predict(&r->state);
+    while (count--) {
+        if (!get_varint(r, &field) || !get_varint(r, &value) || field >= FIELDCOUNT) return 0;
+        r->state.values[field] = value;
+    }
+    
+    r->step++;
+    return 1;
+}
+
+static void print_field(uint16_t i) {
+    if (i < FIELD_GATE)
+        printf("note[%d][%d]", (i - FIELD_NOTE) / HISTORYCOUNT, (i - FIELD_NOTE) % HISTORYCOUNT);
+    else if (i < FIELD_CHANGED)
+        printf("gate[%d][%d]", (i - FIELD_GATE) / HISTORYCOUNT, (i - FIELD_GATE) % HISTORYCOUNT);
+    else if (i < FIELD_MODCV)
+        printf("gateChanged[%d][%d]", (i - FIELD_CHANGED) / HISTORYCOUNT, (i - FIELD_CHANGED) % HISTORYCOUNT);
+    else if (i < FIELD_MODGATE)
+        printf("modCV[%d]", i - FIELD_MODCV);
+    else
+        printf("modGate[%d]", i - FIELD_MODGATE);
+}
+
+static int diff(const char *path_a, const char *path_b) {
+    trace_reader_t a, b;
+    if (!open_trace(path_a, &a) || !open_trace(path_b, &b)) return 2;
+    
+    if (memcmp(a.data + 8, b.data + 8, 5)) printf("configs differ\n");
+    
+    while (1) {
+        int more_a = next_step(&a), more_b = next_step(&b);
+        
+        if (!more_a || !more_b) {
+            if (more_a == more_b && a.pos >= a.size && b.pos >= b.size) {
+                printf("identical, %u steps\n", a.step);
+                return 0;
+            }
+            printf("traces end at different steps: %u and %u\n", a.step, b.step);
+            return 1;
+        }
+        
+        if (memcmp(&a.state, &b.state, sizeof(trace_state_t))) {
+            printf("first difference at step %u:\n", a.step);
+            for (uint16_t i = 0; i < FIELDCOUNT; i++) {
+                if (a.state.values[i] == b.state.values[i]) continue;
+                printf("  ");
+                print_field(i);
+                printf(": %u != %u\n", a.state.values[i], b.state.values[i]);
+            }
+            return 1;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && !strcmp(argv[1], "record")) {
+        engine_config_t config = {
+            argc > 4 ? atoi(argv[4]) : 8,
+            argc > 5 ? atoi(argv[5]) : 1,
+            argc > 6 ? atoi(argv[6]) : 1,
+            argc > 7 ? atoi(argv[7]) : 0,
+            argc > 8 ? atoi(argv[8]) : 0
+        };
+        return record(argv[2], argc > 3 ? atoi(argv[3]) : 1000, &config);
+    }
+    
+    if (argc == 4 && !strcmp(argv[1], "diff")) return diff(argv[2], argv[3]);
+    
+    fprintf(stderr, "usage:\n  %s record out.trace [steps] [length] [algoX] [algoY] [shift] [space]\n  %s diff a.trace b.trace\n", argv[0], argv[0]);
+    return 2;
+}
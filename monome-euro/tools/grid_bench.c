@@ -0,0 +1,122 @@
+// ----------------------------------------------------------------------------
+// grid rendering benchmark
+//
+// measures what a grid frame costs on each page, with the framebuffer that
+// only sends changed LEDs and with the per-LED path it replaced as the
+// baseline. the baseline clears the grid and sends every LED a page draws on
+// its own, every frame. for the framebuffer it measures a full redraw and a
+// frame without changes. then plays for a while with the page changing, with
+// each of them, and counts the LEDs sent. times are host times, so only
+// compare them between builds on the same machine
+//
+// control.c is included rather than linked, as the page renderers and the
+// framebuffer are private to it
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o grid_bench grid_bench.c host_multipass.c ../src/engine.c
+//
+// usage:
+//   grid_bench [frames]
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "host_multipass.h"
+#include "control.c"
+
+// pages as in control.c
+#define PAGECOUNT 5
+
+static const char *page_names[PAGECOUNT] = { "param", "trans", "matrix", "note delay", "i2c" };
+
+static double now_ns(void) {
+    // time.h can't be included, its clock() clashes with the engine's
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1e9 + t.tv_usec * 1e3;
+}
+
+static void render_grid_per_led(void) {
+    // the page as drawn into the framebuffer, sent the way it was before it
+    // had one: a clear, then a write for each LED that isn't dark
+    
+    if (!is_grid_connected()) return;
+    
+    memset(grid_fb, 0, sizeof(grid_fb));
+    render_grid_page();
+    
+    clear_all_grid_leds();
+    for (u8 y = 0; y < GRIDROWS; y++)
+        for (u8 x = 0; x < GRIDCOLS; x++) {
+            u8 level = (grid_fb[y][x >> 1] >> ((x & 1) << 2)) & 15;
+            if (level) set_grid_led(x, y, level);
+        }
+}
+
+static void redraw(void) {
+    u8 data[1] = { 1 };
+    process_event(GRID_CONNECTED, data, 1);
+    render_grid();
+}
+
+static u32 play_session(void (*render)(void)) {
+    // 30s with the page changing every second
+    host_render_grid = render;
+    host_led_writes = 0;
+    for (u32 t = 0; t < 30; t++) {
+        s.page = t % PAGECOUNT;
+        refresh_grid();
+        host_run(host_time + 1000);
+    }
+    host_render_grid = NULL;
+    return host_led_writes;
+}
+
+int main(int argc, char **argv) {
+    u32 frames = argc > 1 ? atoi(argv[1]) : 100000;
+    double start;
+
+    host_boot();
+    host_run(1000);
+
+    printf("%-10s  %-21s  %-21s  %s\n", "", "per LED", "full redraw", "no changes");
+    for (u8 page = 0; page < PAGECOUNT; page++) {
+        s.page = page;
+
+        host_led_writes = 0;
+        render_grid_per_led();
+        u32 old_leds = host_led_writes;
+
+        start = now_ns();
+        for (u32 f = 0; f < frames; f++) render_grid_per_led();
+        double old = (now_ns() - start) / frames;
+
+        host_led_writes = 0;
+        redraw();
+        u32 full_leds = host_led_writes;
+
+        start = now_ns();
+        for (u32 f = 0; f < frames; f++) redraw();
+        double full = (now_ns() - start) / frames;
+
+        host_led_writes = 0;
+        render_grid();
+        u32 same_leds = host_led_writes;
+
+        start = now_ns();
+        for (u32 f = 0; f < frames; f++) render_grid();
+        double same = (now_ns() - start) / frames;
+
+        printf("%-10s  %3d LEDs  %7.0fns  %3d LEDs  %7.0fns  %3d LEDs  %7.0fns\n", page_names[page],
+            old_leds, old, full_leds, full, same_leds, same);
+    }
+
+    u32 old_session = play_session(render_grid_per_led);
+    redraw();
+    u32 session = play_session(NULL);
+    printf("30s of playing and changing pages: %d LEDs sent per LED, %d with the framebuffer\n", old_session, session);
+
+    return 0;
+}
@@ -0,0 +1,237 @@
+// ----------------------------------------------------------------------------
+// host multipass
+//
+// see host_multipass.h. hardware outputs that the check tools don't look at
+// are accepted and dropped
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host_multipass.h"
+#include "interface.h"
+
+typedef struct {
+    u8 is_active;
+    u8 is_repeating;
+    u16 interval;
+    u64 due;
+} host_timer_t;
+
+static host_timer_t timers[HOSTTIMERCOUNT];
+static u8 is_grid_dirty;
+
+u64 host_time;
+u16 host_knob;
+u8 host_external_clock;
+u8 host_is_flash_new = 1;
+u16 host_preset_write_ms, host_shared_write_ms;
+u32 host_flash_writes, host_led_writes;
+u64 host_clock_times[HOSTCLOCKLOG];
+u32 host_clock_count;
+
+host_flash_t host_flash;
+
+void (*host_note)(u8 voice, u16 pitch, u16 volume, u8 on);
+void (*host_timer_added)(u8 index, u16 ms);
+void (*host_debug)(const char *line);
+void (*host_render_grid)(void);
+
+
+// ----------------------------------------------------------------------------
+// running
+
+void host_boot(void) {
+    // multipass initializes flash when it has never been written
+    if (host_is_flash_new) {
+        init_presets();
+        host_is_flash_new = 0;
+    }
+    init_control();
+}
+
+void host_run(u64 until) {
+    // fires timers in order of their due time, each one as a TIMED_EVENT
+    // the way the multipass main loop does
+    
+    while (1) {
+        u8 next = 0, is_found = 0;
+        for (u16 i = 0; i < HOSTTIMERCOUNT; i++) {
+            if (!timers[i].is_active || (is_found && timers[i].due >= timers[next].due)) continue;
+            next = i;
+            is_found = 1;
+        }
+        if (!is_found || timers[next].due > until) break;
+        
+        // a blocking flash write can leave time past the due time
+        if (timers[next].due > host_time) host_time = timers[next].due;
+        if (timers[next].is_repeating)
+            timers[next].due += timers[next].interval;
+        else
+            timers[next].is_active = 0;
+        
+        u8 data[1] = { next };
+        process_event(TIMED_EVENT, data, 1);
+        
+        if (is_grid_dirty) {
+            is_grid_dirty = 0;
+            if (host_render_grid) host_render_grid(); else render_grid();
+        }
+    }
+    
+    if (until > host_time) host_time = until;
+}
+
+void host_press(u8 x, u8 y) {
+    u8 data[3] = { x, y, 1 };
+    process_event(GRID_KEY_PRESSED, data, 3);
+    data[2] = 0;
+    process_event(GRID_KEY_PRESSED, data, 3);
+}
+
+
+// ----------------------------------------------------------------------------
+// timers and clock
+
+void add_timed_event(u8 index, u16 ms, u8 repeat) {
+    if (index >= HOSTTIMERCOUNT) return;
+    if (host_timer_added) host_timer_added(index, ms);
+    
+    timers[index].is_active = 1;
+    timers[index].is_repeating = repeat;
+    timers[index].interval = ms ? ms : 1;
+    timers[index].due = host_time + timers[index].interval;
+}
+
+void stop_timed_event(u8 index) {
+    if (index < HOSTTIMERCOUNT) timers[index].is_active = 0;
+}
+
+void update_timer_interval(u8 index, u16 ms) {
+    if (index < HOSTTIMERCOUNT) timers[index].interval = ms ? ms : 1;
+}
+
+u64 get_global_time(void) {
+    return host_time;
+}
+
+u8 is_external_clock_connected(void) {
+    return host_external_clock;
+}
+
+void set_clock_output(u8 on) {
+    if (on && host_clock_count < HOSTCLOCKLOG) host_clock_times[host_clock_count++] = host_time;
+}
+
+u8 get_knob_count(void) {
+    return 1;
+}
+
+u16 get_knob_value(u8 index) {
+    return host_knob;
+}
+
+
+// ----------------------------------------------------------------------------
+// voices and i2c
+
+void note(u8 voice, u16 note, u16 volume, u8 on) {
+    if (host_note) host_note(voice, note, volume, on);
+}
+
+void map_voice(u8 voice, u8 device, u8 output, u8 on) { }
+void set_jf_mode(u8 mode) { }
+void set_txo_mode(u8 output, u8 mode) { }
+void set_output_transpose(u8 device, u16 output, u16 transpose) { }
+void set_as_i2c_leader(void) { }
+void set_as_i2c_follower(u8 address) { }
+void tx_i2c(u8 address, u8 *data, u8 length) { }
+
+
+// ----------------------------------------------------------------------------
+// grid, arc and screen
+
+u8 is_grid_connected(void) {
+    return 1;
+}
+
+void clear_all_grid_leds(void) {
+    // writes every LED of a 16x8 grid
+    host_led_writes += 128;
+}
+
+void set_grid_led(u8 x, u8 y, u8 level) {
+    host_led_writes++;
+}
+
+void set_grid_led_i(u16 index, u8 level) {
+    host_led_writes++;
+}
+
+void refresh_grid(void) {
+    is_grid_dirty = 1;
+}
+
+u8 is_arc_connected(void) {
+    return 0;
+}
+
+u8 get_arc_encoder_count(void) {
+    return 4;
+}
+
+void clear_all_arc_leds(void) { }
+void set_arc_led(u8 enc, u8 led, u8 level) { }
+void refresh_arc(void) { }
+
+void clear_screen(void) { }
+void fill_line(u8 line, u8 colour) { }
+void draw_str(const char *str, u8 line, u8 colour, u8 background) { }
+void refresh_screen(void) { }
+
+void print_debug(const char *str) {
+    if (host_debug) host_debug(str);
+}
+
+void print_int(const char *str, s16 value) {
+    char line[64];
+    snprintf(line, sizeof(line), "%s %d", str, value);
+    print_debug(line);
+}
+
+
+// ----------------------------------------------------------------------------
+// flash
+
+u8 get_preset_count(void) {
+    return HOSTPRESETCOUNT;
+}
+
+u8 get_preset_index(void) {
+    return host_flash.preset_index;
+}
+
+void store_preset_index(u8 index) {
+    host_flash.preset_index = index;
+}
+
+void store_shared_data_to_flash(shared_data_t *shared) {
+    host_flash.shared = *shared;
+    host_flash_writes++;
+    host_time += host_shared_write_ms;
+}
+
+void load_shared_data_from_flash(shared_data_t *shared) {
+    *shared = host_flash.shared;
+}
+
+void store_preset_to_flash(u8 index, preset_meta_t *meta, preset_data_t *preset) {
+    if (index >= HOSTPRESETCOUNT) return;
+    host_flash.presets[index] = *preset;
+    host_flash_writes++;
+    host_time += host_preset_write_ms;
+}
+
+void load_preset_from_flash(u8 index, preset_data_t *preset) {
+    if (index < HOSTPRESETCOUNT) *preset = host_flash.presets[index];
+}
@@ -0,0 +1,49 @@
+// ----------------------------------------------------------------------------
+// host multipass
+//
+// runs the firmware on a host for the check tools. host_multipass.c
+// implements the multipass functions control.c calls: time is virtual and
+// only moves in host_run(), timers fire in order, flash is kept in RAM and
+// each write can be made to block for a while like the real one
+//
+// the check tools are built together with it, for example:
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o delay_check delay_check.c host_multipass.c ../src/control.c ../src/engine.c
+// ----------------------------------------------------------------------------
+
+#pragma once
+#include "control.h"
+
+#define HOSTPRESETCOUNT 16
+#define HOSTTIMERCOUNT 128
+#define HOSTCLOCKLOG 32768
+
+// state the tools set or read
+extern u64 host_time;
+extern u16 host_knob;
+extern u8 host_external_clock;
+extern u8 host_is_flash_new;
+extern u16 host_preset_write_ms, host_shared_write_ms;
+extern u32 host_flash_writes, host_led_writes;
+extern u64 host_clock_times[HOSTCLOCKLOG];
+extern u32 host_clock_count;
+
+// flash, laid out like flash_layout_t
+typedef struct {
+    u8 fresh;
+    u8 preset_index;
+    shared_data_t shared;
+    preset_data_t presets[HOSTPRESETCOUNT];
+} host_flash_t;
+
+extern host_flash_t host_flash;
+
+// optional hooks. host_render_grid replaces render_grid() for the redraws
+// in host_run()
+extern void (*host_note)(u8 voice, u16 pitch, u16 volume, u8 on);
+extern void (*host_timer_added)(u8 index, u16 ms);
+extern void (*host_debug)(const char *line);
+extern void (*host_render_grid)(void);
+
+void host_boot(void);
+void host_run(u64 until);
+void host_press(u8 x, u8 y);
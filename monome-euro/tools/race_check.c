@@ -0,0 +1,104 @@
+// ----------------------------------------------------------------------------
+// voice output race check
+//
+// clocks the firmware as fast as it runs while a SIGALRM handler, standing in
+// for a timer callback, reads the voice output slot timers use at random
+// moments. every slot it reads has to be one that was complete when it was
+// published, a mix of old and new values means a timer could play a torn note
+//
+// control.c is included rather than linked, as the voice slots are private
+// to it
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o race_check race_check.c host_multipass.c ../src/engine.c
+//
+// usage:
+//   race_check [steps]
+// ----------------------------------------------------------------------------
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "host_multipass.h"
+#include "control.c"
+
+#define SLOTSETSIZE (1 << 20)
+#define READCOUNT (1 << 20)
+
+static u64 published[SLOTSETSIZE];
+static u8 is_used[SLOTSETSIZE];
+static u64 reads[READCOUNT];
+static volatile u32 read_count;
+
+static u64 slot_key(u8 n, voice_out_t *v) {
+    return ((u64)n << 48) | ((u64)v->pitch << 32) | ((u64)v->vol << 16) | (v->on << 8) | v->note;
+}
+
+static u32 slot_hash(u64 key) {
+    return (key * 0x9E3779B97F4A7C15ull) >> 44;
+}
+
+static void publish(u64 key) {
+    u32 h = slot_hash(key);
+    while (is_used[h] && published[h] != key) h = (h + 1) & (SLOTSETSIZE - 1);
+    is_used[h] = 1;
+    published[h] = key;
+}
+
+static int is_published(u64 key) {
+    for (u32 h = slot_hash(key); is_used[h]; h = (h + 1) & (SLOTSETSIZE - 1))
+        if (published[h] == key) return 1;
+    return 0;
+}
+
+static void arm(u32 us) {
+    struct itimerval t = { { 0, 0 }, { 0, us } };
+    setitimer(ITIMER_REAL, &t, NULL);
+}
+
+static void timer_fired(int sig) {
+    u8 n = rand() % NOTECOUNT;
+    voice_out_t v = voice_out[n][(voice_out_sel >> n) & 1];
+    if (read_count < READCOUNT) reads[read_count++] = slot_key(n, &v);
+    arm(5 + rand() % 40);
+}
+
+int main(int argc, char **argv) {
+    u32 steps = argc > 1 ? atoi(argv[1]) : 300000;
+    sigset_t mask;
+
+    host_boot();
+
+    // random volumes and voice stealing, so slots change on most steps
+    host_press(15, 0);
+    host_press(0, 4);
+    host_press(2, 7);
+    host_press(4, 0);
+
+    for (u8 n = 0; n < NOTECOUNT; n++)
+        for (u8 b = 0; b < 2; b++) publish(slot_key(n, &voice_out[n][b]));
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    signal(SIGALRM, timer_fired);
+    arm(20);
+
+    for (u32 i = 0; i < steps; i++) {
+        process_event(MAIN_CLOCK_RECEIVED, NULL, 0);
+
+        // what a timer may see from now on
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+        for (u8 n = 0; n < NOTECOUNT; n++) publish(slot_key(n, &voice_out[n][(voice_out_sel >> n) & 1]));
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    }
+    arm(0);
+
+    u32 torn = 0;
+    for (u32 i = 0; i < read_count; i++)
+        if (!is_published(reads[i])) torn++;
+
+    printf("%d steps, %d reads from a timer, %d torn\n", steps, read_count, torn);
+    return torn != 0;
+}
@@ -0,0 +1,171 @@
+// ----------------------------------------------------------------------------
+// offline renderer
+//
+// runs the firmware on host_multipass faster than realtime and writes what
+// the voices play to a WAV file with one channel per voice, for auditioning
+// presets without a rack. the notes are the ones control.c sends to note(),
+// so volumes, note delays, transposition, the matrix, voices that are off
+// and the voice allocation mode all sound the way they do on the module
+//
+// the preset comes from a bank file (binary, or the debug output of an
+// export with -x), or is the default one without a bank
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o render_wav render_wav.c host_multipass.c bank_reader.c ../src/control.c ../src/engine.c -lm
+//
+// usage:
+//   render_wav [-b bank.bin | -x debug.log] [-p preset] out.wav [seconds]
+// ----------------------------------------------------------------------------
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bank_reader.h"
+#include "host_multipass.h"
+
+#define SAMPLERATE 48000
+#define BLOCKSIZE (SAMPLERATE / 1000)
+#define ATTACK 0.005f
+#define RELEASE 0.15f
+#define TRANSPOSE 36
+#define FULLVOLUME 8000.f
+
+static float freq[NOTECOUNT], phase[NOTECOUNT], level[NOTECOUNT], target[NOTECOUNT];
+
+static void write_u32(FILE *f, uint32_t v) {
+    uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    fwrite(b, 1, 4, f);
+}
+
+static void write_u16(FILE *f, uint16_t v) {
+    uint8_t b[2] = { v, v >> 8 };
+    fwrite(b, 1, 2, f);
+}
+
+static void write_header(FILE *f, uint32_t frames) {
+    uint32_t bytes = frames * NOTECOUNT * 2;
+
+    fwrite("RIFF", 1, 4, f);
+    write_u32(f, 36 + bytes);
+    fwrite("WAVEfmt ", 1, 8, f);
+    write_u32(f, 16);
+    write_u16(f, 1);
+    write_u16(f, NOTECOUNT);
+    write_u32(f, SAMPLERATE);
+    write_u32(f, SAMPLERATE * NOTECOUNT * 2);
+    write_u16(f, NOTECOUNT * 2);
+    write_u16(f, 16);
+    fwrite("data", 1, 4, f);
+    write_u32(f, bytes);
+}
+
+static void note_played(u8 voice, u16 pitch, u16 volume, u8 on) {
+    // a note starts the envelope at its volume, the end of the gate (or a
+    // note that's stopped) releases it
+    if (voice >= NOTECOUNT) return;
+    if (on) freq[voice] = 440.f * powf(2.f, ((int)pitch + TRANSPOSE - 69) / 12.f) / SAMPLERATE;
+    target[voice] = on ? fminf(volume / FULLVOLUME, 1.f) : 0.f;
+}
+
+static void render_block(int16_t *out) {
+    float attack = 1.f / (ATTACK * SAMPLERATE), release = 1.f / (RELEASE * SAMPLERATE);
+
+    for (uint8_t n = 0; n < NOTECOUNT; n++) {
+        float p = phase[n], l = level[n], t = target[n], f = freq[n];
+
+        for (uint16_t i = 0; i < BLOCKSIZE; i++) {
+            l = t > l ? fminf(l + attack, t) : fmaxf(l - release, t);
+            p += f;
+            p -= (int)p;
+            // triangle, softer than a saw and cheaper than a sine
+            out[i * NOTECOUNT + n] = (int16_t)((4.f * fabsf(p - .5f) - 1.f) * l * 0.5f * 32767.f);
+        }
+
+        phase[n] = p;
+        level[n] = l;
+    }
+}
+
+static int load_bank(const char *path, int is_hex) {
+    // the bank goes into the host flash with every slot marked as saved, so
+    // the firmware boots on it the way it would after an import
+
+    bank_reader_t bank;
+    preset_data_t preset;
+    FILE *in = fopen(path, is_hex ? "r" : "rb");
+    if (!in) {
+        perror(path);
+        return 0;
+    }
+
+    int ok = open_bank(&bank, in, is_hex) && read_shared_record(&bank, &host_flash.shared);
+    for (uint8_t i = 0; ok && i < bank.preset_count; i++) {
+        ok = read_preset_record(&bank, i, &preset);
+        if (ok && i < HOSTPRESETCOUNT) host_flash.presets[i] = preset;
+    }
+    fclose(in);
+    if (!ok) return 0;
+
+    if (bank.preset_count > HOSTPRESETCOUNT)
+        fprintf(stderr, "only the first %d presets are used\n", HOSTPRESETCOUNT);
+    memset(host_flash.shared.saved_presets, 0xFF, sizeof(host_flash.shared.saved_presets));
+    host_flash.shared.version = FLASHVERSION;
+    host_is_flash_new = 0;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    const char *bank = NULL;
+    int is_hex = 0, preset = 0, arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!strcmp(argv[arg], "-b") || !strcmp(argv[arg], "-x")) {
+            bank = argv[arg + 1];
+            is_hex = argv[arg][1] == 'x';
+        } else if (!strcmp(argv[arg], "-p")) {
+            preset = atoi(argv[arg + 1]);
+        } else {
+            break;
+        }
+    }
+
+    if (arg >= argc || preset < 0 || preset >= HOSTPRESETCOUNT) {
+        fprintf(stderr, "usage: %s [-b bank.bin | -x debug.log] [-p preset] out.wav [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t seconds = arg + 1 < argc ? atoi(argv[arg + 1]) : 16;
+    if (bank) {
+        if (!load_bank(bank, is_hex)) return 1;
+    } else {
+        init_presets();
+        host_is_flash_new = 0;
+    }
+    host_flash.preset_index = preset;
+
+    FILE *f = fopen(argv[arg], "wb");
+    if (!f) {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    host_note = note_played;
+    host_boot();
+
+    // one block for each millisecond of host time, the notes of that
+    // millisecond start at the beginning of its block
+    uint32_t frames = seconds * SAMPLERATE;
+    int16_t block[BLOCKSIZE * NOTECOUNT];
+    write_header(f, frames);
+
+    for (uint32_t now = 0; now < frames; now += BLOCKSIZE) {
+        host_run(host_time + 1);
+        render_block(block);
+        fwrite(block, sizeof(int16_t), BLOCKSIZE * NOTECOUNT, f);
+    }
+
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,59 @@
+// ----------------------------------------------------------------------------
+// preset save timing check
+//
+// saves the preset again and again while the internal clock runs, with flash
+// writes that block like the real ones, and measures how far the clock ticks
+// move. saves are split into one write after each step, so no tick should
+// move by more than the 1ms a tick can be off anyway. also checks that the
+// last save ended up in flash
+//
+// build (from monome-euro/tools):
+//   cc -O2 -I../src -I../multipass/src -I../multipass/libavr32/src -o save_check save_check.c host_multipass.c ../src/control.c ../src/engine.c
+//
+// usage:
+//   save_check [saves] [preset write ms] [shared write ms]
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_multipass.h"
+#include "interface.h"
+
+extern preset_data_t p;
+extern u8 selected_preset;
+
+int main(int argc, char **argv) {
+    u32 saves = argc > 1 ? atoi(argv[1]) : 40;
+    host_preset_write_ms = argc > 2 ? atoi(argv[2]) : 12;
+    host_shared_write_ms = argc > 3 ? atoi(argv[3]) : 4;
+
+    host_boot();
+    p.speed = 620;
+    host_run(host_time + 1000);
+    host_clock_count = 0;
+    host_flash_writes = 0;
+
+    // saves at times that fall on different parts of a step
+    for (u32 i = 0; i < saves; i++) {
+        host_run(host_time + 1000 + i * 37);
+        p.config.length = 4 + i % 28;
+        u8 data[1] = { 0 };
+        process_event(FRONT_BUTTON_HELD, data, 1);
+    }
+    host_run(host_time + 2000);
+
+    double period = 60000.0 / p.speed, worst = 0;
+    for (u32 i = 1; i < host_clock_count; i++) {
+        double d = (host_clock_times[i] - host_clock_times[i - 1]) - period;
+        if (d < 0) d = -d;
+        if (d > worst) worst = d;
+    }
+
+    int is_saved = !memcmp(&host_flash.presets[selected_preset], &p, sizeof(preset_data_t));
+    printf("%d saves, %d flash writes, %d ticks of %.3fms, worst tick %.3fms off, last save %s\n",
+        saves, host_flash_writes, host_clock_count, period, worst, is_saved ? "in flash" : "missing");
+
+    return worst >= 1 || !is_saved;
+}
@@ -0,0 +1,162 @@
+// ----------------------------------------------------------------------------
+// event trace replay
+//
+// reads the debug output of a build with EVENT_TRACE, takes the last trace in
+// it (each boot starts a new one) and plays it back through replay_trace,
+// printing every note the firmware plays with the time since the trace
+// started, then the settings it ended with. two builds can be compared by
+// diffing what they print for the same trace. presets are the ones in the
+// host flash, so a trace recorded on a slot that was saved with other values
+// won't play back the same
+//
+// build (from monome-euro/tools):
+//   cc -O2 -DEVENT_TRACE -I../src -I../multipass/src -I../multipass/libavr32/src -o trace_replay trace_replay.c host_multipass.c ../src/control.c ../src/engine.c
+//
+// usage:
+//   trace_replay debug.log > notes.txt
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_multipass.h"
+
+#ifndef EVENT_TRACE
+#error trace_replay needs EVENT_TRACE
+#endif
+
+extern u32 replay_time;
+extern preset_data_t p;
+
+static trace_header_t header;
+static trace_entry_t *entries;
+static u32 entry_count, entry_size;
+
+
+// ----------------------------------------------------------------------------
+// helpers
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int parse_hex(const char *line, u8 *bytes, size_t length) {
+    // a line of exactly length bytes as hex
+    if (strlen(line) != length * 2) return 0;
+    for (size_t i = 0; i < length; i++) {
+        int hi = hex_digit(line[i * 2]), lo = hex_digit(line[i * 2 + 1]);
+        if (hi < 0 || lo < 0) return 0;
+        bytes[i] = (hi << 4) | lo;
+    }
+    return 1;
+}
+
+static u32 get_value(u8 *bytes, u8 size) {
+    u32 value = 0;
+    for (u8 b = 0; b < size; b++) value |= (u32)bytes[b] << (b * 8);
+    return value;
+}
+
+static void note_played(u8 voice, u16 pitch, u16 volume, u8 on) {
+    printf("%u %d %d %d %d\n", replay_time, voice, pitch, volume, on);
+}
+
+
+// ----------------------------------------------------------------------------
+// reading
+
+static int read_trace(FILE *in) {
+    // hex lines after the last "trace" line are the header and the entries.
+    // bank exports are skipped, other debug lines aren't hex of the right
+    // length
+
+    char line[256];
+    u8 bytes[TRACEENTRYLEN];
+    int is_trace = 0, is_header = 0, is_bank = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\r\n")] = 0;
+
+        if (is_bank) {
+            is_bank = strcmp(line, "end");
+            continue;
+        }
+        if (!strcmp(line, "bank")) {
+            is_bank = 1;
+            continue;
+        }
+        if (!strcmp(line, "trace")) {
+            is_trace = 1;
+            is_header = 0;
+            entry_count = 0;
+            continue;
+        }
+        if (!is_trace) continue;
+
+        if (!is_header) {
+            if (!parse_hex(line, bytes, TRACEHEADERLEN)) continue;
+            header.seed = get_value(bytes, 4);
+            header.preset = bytes[4];
+            header.knob_count = bytes[5];
+            header.knob = get_value(bytes + 6, 2);
+            is_header = 1;
+            continue;
+        }
+
+        if (!parse_hex(line, bytes, TRACEENTRYLEN)) continue;
+        if (entry_count == 0xFFFF) {
+            fprintf(stderr, "trace is longer than replay_trace takes, the rest is ignored\n");
+            break;
+        }
+        if (entry_count == entry_size) {
+            entry_size = entry_size ? entry_size * 2 : 1024;
+            entries = realloc(entries, entry_size * sizeof(trace_entry_t));
+            if (!entries) {
+                perror("trace_replay");
+                exit(1);
+            }
+        }
+
+        trace_entry_t *e = &entries[entry_count++];
+        e->delta = get_value(bytes, 2);
+        e->event = bytes[2];
+        e->length = bytes[3] > TRACEDATALEN ? TRACEDATALEN : bytes[3];
+        memcpy(e->data, bytes + 4, TRACEDATALEN);
+    }
+
+    return is_header;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage:\n  %s debug.log > notes.txt\n", argv[0]);
+        return 2;
+    }
+
+    FILE *in = fopen(argv[1], "r");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    int is_found = read_trace(in);
+    fclose(in);
+
+    if (!is_found) {
+        fprintf(stderr, "no trace found\n");
+        return 1;
+    }
+
+    host_boot();
+    host_note = note_played;
+    replay_trace(&header, entries, entry_count);
+    printf("end %u speed %d length %d algoX %d algoY %d shift %d space %d\n", replay_time, p.speed, p.config.length,
+        p.config.algoX, p.config.algoY, p.config.shift, p.config.space);
+
+    fprintf(stderr, "%u entries replayed, preset %d, seed %08x\n", entry_count, header.preset, header.seed);
+    free(entries);
+    return 0;
+}